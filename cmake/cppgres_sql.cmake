@@ -0,0 +1,49 @@
+# Writes the SQL statements collected in the SQL section of a shared library into an extension
+# script, each statement terminated by a semicolon
+#
+# Invoked by `cppgres_sql_script` with LIBRARY, OUTPUT, OBJCOPY and SECTION defined.
+
+execute_process(
+        COMMAND ${OBJCOPY} --dump-section ${SECTION}=${OUTPUT}.section ${LIBRARY} ${OUTPUT}.library
+        RESULT_VARIABLE _result
+        ERROR_VARIABLE _error)
+file(REMOVE ${OUTPUT}.library)
+
+set(_script "")
+if (_result EQUAL 0)
+    file(READ ${OUTPUT}.section _section HEX)
+    file(REMOVE ${OUTPUT}.section)
+    # statements are NUL-terminated; they are split and decoded byte by byte rather than read
+    # as a list, which wouldn't preserve semicolons, brackets and newlines within them
+    string(REGEX MATCHALL "(([1-9a-f][0-9a-f])|(0[1-9a-f]))*00" _statements "${_section}")
+    # statements are prefixed with the (single digit) stage they run in, so that objects are
+    # created after those they depend on; within a stage, the section's order is kept
+    set(_stages "")
+    foreach (_hex IN LISTS _statements)
+        if (_hex STREQUAL "00")
+            # padding
+            continue()
+        endif ()
+        string(REGEX MATCHALL ".." _bytes "${_hex}")
+        list(POP_BACK _bytes)
+        set(_statement "")
+        foreach (_byte IN LISTS _bytes)
+            math(EXPR _code "0x${_byte}")
+            string(ASCII ${_code} _char)
+            string(APPEND _statement "${_char}")
+        endforeach ()
+        string(SUBSTRING "${_statement}" 0 1 _stage)
+        string(SUBSTRING "${_statement}" 2 -1 _statement)
+        list(APPEND _stages ${_stage})
+        string(APPEND _stage_${_stage} "${_statement};\n")
+    endforeach ()
+    list(REMOVE_DUPLICATES _stages)
+    list(SORT _stages)
+    foreach (_stage IN LISTS _stages)
+        string(APPEND _script "${_stage_${_stage}}")
+    endforeach ()
+else ()
+    message(WARNING "no SQL declarations found in ${LIBRARY}: ${_error}")
+endif ()
+
+file(WRITE ${OUTPUT} "${_script}")
@@ -1,13 +1,91 @@
 #pragma once
 
+#include "cppgres/aggregate.h"
 #include "cppgres/datum.h"
+#include "cppgres/direct_executor.h"
 #include "cppgres/error.h"
 #include "cppgres/executor.h"
 #include "cppgres/function.h"
 #include "cppgres/guard.h"
 #include "cppgres/imports.h"
+#include "cppgres/index.h"
 #include "cppgres/memory.h"
+#include "cppgres/set_returning_function.h"
+#include "cppgres/sql.h"
+#include "cppgres/support.h"
+#include "cppgres/table.h"
 #include "cppgres/types.h"
+#include "cppgres/window.h"
 
 #define postgres_function(name, function)                                                          \
   extern "C" Datum name(PG_FUNCTION_ARGS) { return cppgres::postgres_function(function)(fcinfo); }
+
+#define postgres_function_sql(name, signature, ...)                                                \
+  [[gnu::used, gnu::retain, gnu::section(CPPGRES_SQL_SECTION)]] static constexpr auto              \
+      cppgres_sql_##name =                                                                         \
+          cppgres::sql::create_function(#name, signature __VA_OPT__(, ) __VA_ARGS__)
+
+#define postgres_composite_type_sql(name, fields)                                                  \
+  [[gnu::used, gnu::retain, gnu::section(CPPGRES_SQL_SECTION)]] static constexpr auto              \
+      cppgres_sql_type_##name = cppgres::sql::create_composite_type(#name, fields)
+
+#define postgres_strict_function(name, function)                                                   \
+  extern "C" Datum name(PG_FUNCTION_ARGS) {                                                        \
+    return cppgres::postgres_strict_function(function)(fcinfo);                                    \
+  }
+
+#define postgres_set_returning_function(name, function)                                            \
+  extern "C" Datum name(PG_FUNCTION_ARGS) {                                                        \
+    return cppgres::postgres_set_returning_function<                                               \
+        std::decay_t<decltype(function)>, cppgres::set_returning_mode::value_per_call>(function)(  \
+        fcinfo);                                                                                   \
+  }
+
+#define postgres_materialized_function(name, function)                                             \
+  extern "C" Datum name(PG_FUNCTION_ARGS) {                                                        \
+    return cppgres::postgres_set_returning_function<                                               \
+        std::decay_t<decltype(function)>, cppgres::set_returning_mode::materialize>(function)(     \
+        fcinfo);                                                                                   \
+  }
+
+#define postgres_window_function(name, function)                                                   \
+  extern "C" Datum name(PG_FUNCTION_ARGS) {                                                        \
+    return cppgres::postgres_window_function(function)(fcinfo);                                    \
+  }
+
+#define postgres_support_function(name, handler)                                                   \
+  extern "C" Datum name(PG_FUNCTION_ARGS) {                                                        \
+    return cppgres::postgres_support_function(handler)(fcinfo);                                    \
+  }
+
+#define postgres_aggregate(name, state)                                                            \
+  extern "C" {                                                                                     \
+  Datum name##_transfn(PG_FUNCTION_ARGS) {                                                         \
+    return cppgres::postgres_aggregate<state>::transition(fcinfo);                                 \
+  }                                                                                                \
+  Datum name##_finalfn(PG_FUNCTION_ARGS) {                                                         \
+    return cppgres::postgres_aggregate<state>::final(fcinfo);                                      \
+  }                                                                                                \
+  }
+
+#define postgres_parallel_aggregate(name, state)                                                   \
+  postgres_aggregate(name, state)                                                                  \
+  extern "C" {                                                                                     \
+  Datum name##_combinefn(PG_FUNCTION_ARGS) {                                                       \
+    return cppgres::postgres_aggregate<state>::combine(fcinfo);                                    \
+  }                                                                                                \
+  Datum name##_serialfn(PG_FUNCTION_ARGS) {                                                        \
+    return cppgres::postgres_aggregate<state>::serialize(fcinfo);                                  \
+  }                                                                                                \
+  Datum name##_deserialfn(PG_FUNCTION_ARGS) {                                                      \
+    return cppgres::postgres_aggregate<state>::deserialize(fcinfo);                                \
+  }                                                                                                \
+  }
+
+#define postgres_aggregate_sql(name, arguments)                                                    \
+  [[gnu::used, gnu::retain, gnu::section(CPPGRES_SQL_SECTION)]] static constexpr auto              \
+      cppgres_sql_aggregate_##name = cppgres::sql::create_aggregate(#name, arguments)
+
+#define postgres_parallel_aggregate_sql(name, arguments)                                           \
+  [[gnu::used, gnu::retain, gnu::section(CPPGRES_SQL_SECTION)]] static constexpr auto              \
+      cppgres_sql_aggregate_##name = cppgres::sql::create_parallel_aggregate(#name, arguments)
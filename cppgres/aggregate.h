@@ -0,0 +1,215 @@
+#pragma once
+
+#include "datum.h"
+#include "error.h"
+#include "function.h"
+#include "guard.h"
+#include "utils/function_traits.h"
+#include "utils/utils.h"
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include <utils/memutils.h>
+#include <varatt.h>
+}
+
+namespace cppgres {
+
+/**
+ * State of an aggregate
+ *
+ * `update` is called for every input row with the aggregated values and `finalize`
+ * computes the result from the state.
+ */
+template <typename S>
+concept aggregate_state =
+    std::default_initializable<S> && datumable_arguments<decltype(&S::update)> &&
+    requires(const S &s) {
+      { s.finalize() } -> convertible_into_nullable_datum;
+    };
+
+/**
+ * Aggregate state that can merge another partial state into itself, so that the aggregate
+ * can be computed in parallel
+ */
+template <typename S>
+concept combinable_aggregate_state =
+    aggregate_state<S> && std::copy_constructible<S> && requires(S &s, const S &other) {
+      { s.combine(other) };
+    };
+
+/**
+ * Aggregate state that can be passed between parallel workers
+ *
+ * `serialize` returns a contiguous range of bytes that `deserialize` turns back into an
+ * equivalent state.
+ */
+template <typename S>
+concept serializable_aggregate_state =
+    aggregate_state<S> && requires(const S &s, std::span<const std::byte> bytes) {
+      { s.serialize() } -> std::ranges::contiguous_range;
+      requires sizeof(std::ranges::range_value_t<decltype(s.serialize())>) == 1;
+      { S::deserialize(bytes) } -> std::same_as<S>;
+    };
+
+/**
+ * Support functions of an aggregate whose state is an `S` (aggregate `stype` is
+ * `internal`)
+ *
+ * The state is constructed in the aggregate memory context on the first input row and
+ * updated in place, never copied between rows; it is destroyed when that context is reset
+ * or deleted. Rows in which any non-optional argument is null are skipped, like they are for
+ * strict transition functions. If no rows were aggregated, `finalize` is called on a
+ * default-constructed state.
+ */
+template <aggregate_state S> struct postgres_aggregate {
+  using update_arguments =
+      typename utils::function_traits::function_traits<decltype(&S::update)>::argument_types;
+
+  static ::Datum transition(FunctionCallInfo fc) {
+    return exception_guarded([&] {
+      auto ctx = aggregate_context(fc);
+      auto site = static_cast<call_site *>(fc->flinfo->fn_extra);
+      if (site == nullptr || !site->arguments_checked) {
+        check_argument_types<decltype(&S::update), 1>(fc);
+        call_site::of(fc).arguments_checked = true;
+      }
+      auto s = fc->args[0].isnull ? nullptr : state_of(fc->args[0].value);
+      if (has_null_arguments(fc)) {
+        return s == nullptr ? null(fc) : ::PointerGetDatum(s);
+      }
+      if (s == nullptr) {
+        s = make_state(ctx);
+      }
+      auto args = convert_arguments<decltype(&S::update), 1>(
+          fc, call_site::of(fc).rows<decltype(&S::update)>(fc));
+      std::apply([&](auto &&...args) { s->state.update(std::forward<decltype(args)>(args)...); },
+                 args);
+      return ::PointerGetDatum(s);
+    });
+  }
+
+  static ::Datum final(FunctionCallInfo fc) {
+    return exception_guarded([&] {
+      aggregate_context(fc);
+      auto result = [&] {
+        if (fc->args[0].isnull) {
+          const S empty{};
+          return empty.finalize();
+        }
+        return std::as_const(state_of(fc->args[0].value)->state).finalize();
+      }();
+      nullable_datum nd = into_nullable_datum(result);
+      if (nd.is_null()) {
+        return null(fc);
+      }
+      return static_cast<::Datum>(nd);
+    });
+  }
+
+  static ::Datum combine(FunctionCallInfo fc)
+    requires combinable_aggregate_state<S>
+  {
+    return exception_guarded([&] {
+      auto ctx = aggregate_context(fc);
+      auto s1 = fc->args[0].isnull ? nullptr : state_of(fc->args[0].value);
+      auto s2 = fc->args[1].isnull ? nullptr : state_of(fc->args[1].value);
+      if (s2 == nullptr) {
+        return s1 == nullptr ? null(fc) : ::PointerGetDatum(s1);
+      }
+      if (s1 == nullptr) {
+        // the combined state must live in the aggregate context of this call
+        return ::PointerGetDatum(make_state(ctx, std::as_const(s2->state)));
+      }
+      s1->state.combine(std::as_const(s2->state));
+      return ::PointerGetDatum(s1);
+    });
+  }
+
+  static ::Datum serialize(FunctionCallInfo fc)
+    requires serializable_aggregate_state<S>
+  {
+    return exception_guarded([&] {
+      aggregate_context(fc);
+      auto bytes = std::as_const(state_of(fc->args[0].value)->state).serialize();
+      auto size = std::ranges::size(bytes);
+      auto result = static_cast<::bytea *>(ffi_guarded(::palloc)(VARHDRSZ + size));
+      SET_VARSIZE(result, VARHDRSZ + size);
+      std::memcpy(VARDATA(result), std::ranges::data(bytes), size);
+      return ::PointerGetDatum(result);
+    });
+  }
+
+  static ::Datum deserialize(FunctionCallInfo fc)
+    requires serializable_aggregate_state<S>
+  {
+    return exception_guarded([&] {
+      auto ctx = aggregate_context(fc);
+      auto bytes = ffi_guarded(::pg_detoast_datum_packed)(
+          reinterpret_cast<::varlena *>(DatumGetPointer(fc->args[0].value)));
+      auto data = std::span<const std::byte>(
+          reinterpret_cast<const std::byte *>(VARDATA_ANY(bytes)), VARSIZE_ANY_EXHDR(bytes));
+      return ::PointerGetDatum(make_state(ctx, S::deserialize(data)));
+    });
+  }
+
+private:
+  /**
+   * State together with the callback that destroys it
+   */
+  struct holder {
+    template <typename... Args>
+    explicit holder(Args &&...args) : state(std::forward<Args>(args)...) {}
+
+    S state;
+    ::MemoryContextCallback callback;
+  };
+
+  static holder *state_of(::Datum datum) {
+    return reinterpret_cast<holder *>(DatumGetPointer(datum));
+  }
+
+  template <typename... Args> static holder *make_state(::MemoryContext ctx, Args &&...args) {
+    static_assert(alignof(holder) <= MAXIMUM_ALIGNOF,
+                  "aggregate states can't be more strictly aligned than palloc'd memory");
+    auto memory = ffi_guarded(::MemoryContextAlloc)(ctx, sizeof(holder));
+    auto h = new (memory) holder(std::forward<Args>(args)...);
+    h->callback.func = [](void *arg) { static_cast<holder *>(arg)->~holder(); };
+    h->callback.arg = h;
+    ffi_guarded(::MemoryContextRegisterResetCallback)(ctx, &h->callback);
+    return h;
+  }
+
+  static ::MemoryContext aggregate_context(FunctionCallInfo fc) {
+    ::MemoryContext ctx;
+    if (!ffi_guarded(::AggCheckCallContext)(fc, &ctx)) {
+      throw std::runtime_error("aggregate function called in non-aggregate context");
+    }
+    return ctx;
+  }
+
+  static bool has_null_arguments(FunctionCallInfo fc) {
+    return [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+      return (
+          (!utils::is_optional<std::remove_cvref_t<std::tuple_element_t<Is, update_arguments>>> &&
+           Is + 1 < static_cast<std::size_t>(fc->nargs) && fc->args[Is + 1].isnull) ||
+          ...);
+    }(std::make_index_sequence<std::tuple_size_v<update_arguments>>{});
+  }
+
+  static ::Datum null(FunctionCallInfo fc) {
+    fc->isnull = true;
+    return ::Datum(0);
+  }
+};
+
+} // namespace cppgres
@@ -82,6 +82,25 @@ concept convertible_into_nullable_datum = requires(T t) {
   { cppgres::into_nullable_datum(t) } -> std::same_as<nullable_datum>;
 };
 
+/**
+ * Converts a single attribute value into `T`
+ *
+ * A null value for `T` that is not an `std::optional` throws `null_datum_exception`.
+ */
+template <typename T>
+  requires convertible_from_nullable_datum<utils::remove_optional_t<T>>
+T decode_datum(nullable_datum &nd) {
+  auto value = from_nullable_datum<utils::remove_optional_t<T>>(nd);
+  if constexpr (utils::is_optional<T>) {
+    return value;
+  } else {
+    if (!value.has_value()) {
+      throw null_datum_exception();
+    }
+    return std::move(*value);
+  }
+}
+
 template <typename Tuple> struct all_from_nullable_datum;
 
 template <typename... Ts> struct all_from_nullable_datum<std::tuple<Ts...>> {
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "executor.h"
+#include "guard.h"
+#include "memory.h"
+
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+extern "C" {
+#include <access/xact.h>
+#include <executor/executor.h>
+#include <tcop/tcopprot.h>
+#include <tcop/utility.h>
+#include <utils/snapmgr.h>
+}
+
+namespace cppgres {
+
+/**
+ * Executor that plans statements with `pg_plan_query` and runs them with the executor
+ * directly, without SPI
+ *
+ * Offers the same `query` and `for_each` interface as `spi_executor`. Rows returned by
+ * `query` are kept in memory owned by the executor and remain valid until it is destroyed.
+ * Only a single, non-utility statement can be executed at a time.
+ */
+struct direct_executor : public executor {
+  direct_executor() = default;
+
+  template <datumable_tuple Ret, convertible_into_nullable_datum... Args>
+  spi_executor::results<Ret> query(std::string_view query, Args &&...args) {
+    return this->query<Ret>(execution_options{}, query, std::forward<Args>(args)...);
+  }
+
+  template <datumable_tuple Ret, convertible_into_nullable_datum... Args>
+  spi_executor::results<Ret> query(const execution_options &options, std::string_view query,
+                                   Args &&...args) {
+    query_arguments<std::remove_cvref_t<Args>...> arguments(args...);
+    tuptable_receiver receiver(ctx);
+    run(query, arguments, options, receiver, true);
+    if (receiver.table == nullptr) {
+      throw std::runtime_error("statement does not return rows");
+    }
+    if (receiver.table->tupdesc->natts != std::tuple_size_v<Ret>) {
+      throw std::runtime_error(std::format("expected {} return values, got {}",
+                                           std::tuple_size_v<Ret>,
+                                           receiver.table->tupdesc->natts));
+    }
+    return spi_executor::results<Ret>(receiver.table);
+  }
+
+  /**
+   * Executes `query`, passing every row to `func` as the executor produces it
+   *
+   * See `spi_executor::for_each`.
+   */
+  template <datumable_tuple Ret, typename Func, convertible_into_nullable_datum... Args>
+    requires std::invocable<Func &, Ret &>
+  uint64_t for_each(std::string_view query, Func &&func, Args &&...args) {
+    return for_each<Ret>(execution_options{}, query, std::forward<Func>(func),
+                         std::forward<Args>(args)...);
+  }
+
+  template <datumable_tuple Ret, typename Func, convertible_into_nullable_datum... Args>
+    requires std::invocable<Func &, Ret &>
+  uint64_t for_each(const execution_options &options, std::string_view query, Func &&func,
+                    Args &&...args) {
+    query_arguments<std::remove_cvref_t<Args>...> arguments(args...);
+    callback_receiver<Ret, Func> receiver(func);
+    try {
+      run(query, arguments, options, receiver, false);
+    } catch (...) {
+      receiver.rethrow();
+      throw;
+    }
+    receiver.rethrow();
+    return receiver.processed();
+  }
+
+private:
+  /**
+   * Destination receiver that copies tuples into an `SPITupleTable`-shaped table allocated
+   * in the executor's memory context, so that `spi_executor::results` can be reused
+   *
+   * The table is not known to SPI and must not be passed to SPI functions.
+   */
+  struct tuptable_receiver {
+    explicit tuptable_receiver(::MemoryContext mcxt) : mcxt(mcxt) {
+      receiver.receiveSlot = receive_slot;
+      receiver.rStartup = startup;
+      receiver.rShutdown = [](::DestReceiver *) {};
+      receiver.rDestroy = [](::DestReceiver *) {};
+      receiver.mydest = ::DestNone;
+    }
+
+    operator ::DestReceiver *() { return &receiver; }
+
+    // must remain the first member: the executor only sees a pointer to it
+    ::DestReceiver receiver;
+    ::MemoryContext mcxt;
+    ::SPITupleTable *table = nullptr;
+
+  private:
+    static tuptable_receiver *self(::DestReceiver *receiver) {
+      static_assert(std::is_standard_layout_v<tuptable_receiver>,
+                    "the receiver must be pointer-interconvertible with its first member");
+      return reinterpret_cast<tuptable_receiver *>(receiver);
+    }
+
+    static void startup(::DestReceiver *receiver, int, ::TupleDesc tupdesc) {
+      auto r = self(receiver);
+      auto old_ctx = ::MemoryContextSwitchTo(r->mcxt);
+      r->table = static_cast<::SPITupleTable *>(::palloc0(sizeof(::SPITupleTable)));
+      r->table->tuptabcxt = r->mcxt;
+      r->table->tupdesc = ::CreateTupleDescCopy(tupdesc);
+      r->table->alloced = 128;
+      r->table->vals = static_cast<::HeapTuple *>(::palloc(sizeof(::HeapTuple) * 128));
+      ::MemoryContextSwitchTo(old_ctx);
+    }
+
+    static bool receive_slot(::TupleTableSlot *slot, ::DestReceiver *receiver) {
+      auto r = self(receiver);
+      auto old_ctx = ::MemoryContextSwitchTo(r->mcxt);
+      if (r->table->numvals == r->table->alloced) {
+        r->table->alloced *= 2;
+        r->table->vals = static_cast<::HeapTuple *>(
+            ::repalloc_huge(r->table->vals, sizeof(::HeapTuple) * r->table->alloced));
+      }
+      r->table->vals[r->table->numvals++] = ::ExecCopySlotHeapTuple(slot);
+      ::MemoryContextSwitchTo(old_ctx);
+      return true;
+    }
+  };
+
+  /**
+   * Plans and executes `query`, sending its rows to `dest`
+   *
+   * Statements that don't return rows are rejected before execution if `returns_rows` is
+   * set. If execution fails, the error must be handled by aborting the (sub)transaction.
+   */
+  template <typename... Args>
+  void run(std::string_view query, query_arguments<Args...> &arguments,
+           const execution_options &options, ::DestReceiver *dest, bool returns_rows) {
+    std::string source(query);
+    param_list<sizeof...(Args)> params(arguments);
+    ::ParamListInfo param_info =
+        sizeof...(Args) > 0 ? static_cast<::ParamListInfo>(params) : nullptr;
+
+    // parse trees and plans only live for the duration of the statement
+    alloc_set_memory_context statement_ctx;
+
+    ffi_guarded([](const char *source, ::Oid *types, int nargs, ::ParamListInfo params,
+                   const execution_options *options, ::DestReceiver *dest, bool returns_rows,
+                   ::MemoryContext statement_ctx) {
+      auto old_ctx = ::MemoryContextSwitchTo(statement_ctx);
+
+      ::List *raw = ::pg_parse_query(source);
+      if (list_length(raw) != 1) {
+        ereport(ERROR, errcode(ERRCODE_SYNTAX_ERROR),
+                errmsg("exactly one statement is expected, got %d", list_length(raw)));
+      }
+      ::List *queries = ::pg_analyze_and_rewrite_fixedparams(linitial_node(RawStmt, raw), source,
+                                                              types, nargs, nullptr);
+      if (list_length(queries) != 1) {
+        ereport(ERROR, errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                errmsg("statements rewritten into multiple queries are not supported"));
+      }
+      ::Query *q = linitial_node(Query, queries);
+      if (q->commandType == ::CMD_UTILITY) {
+        ereport(ERROR, errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                errmsg("utility statements are not supported"));
+      }
+      ::PlannedStmt *stmt = ::pg_plan_query(
+          q, source, options->parallel_ok ? CURSOR_OPT_PARALLEL_OK : 0, params);
+      if (options->read_only && !::CommandIsReadOnly(stmt)) {
+        ereport(ERROR, errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                errmsg("%s is not allowed in a read-only execution",
+                       ::GetCommandTagName(::CreateCommandTag(reinterpret_cast<::Node *>(stmt)))));
+      }
+      if (returns_rows && stmt->commandType != ::CMD_SELECT && !stmt->hasReturning) {
+        ereport(ERROR, errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                errmsg("statement does not return rows"));
+      }
+
+      if (options->read_only) {
+        ::PushActiveSnapshot(::GetActiveSnapshot());
+      } else {
+        ::CommandCounterIncrement();
+        ::PushActiveSnapshot(::GetTransactionSnapshot());
+      }
+
+      // a failed statement's executor state and snapshot are left to the abort of the
+      // (sub)transaction, as they are for SPI and portals
+      ::QueryDesc *qd = ::CreateQueryDesc(stmt, source, ::GetActiveSnapshot(), InvalidSnapshot,
+                                          dest, params, nullptr, 0);
+      ::ExecutorStart(qd, 0);
+      ::ExecutorRun(qd, ::ForwardScanDirection, options->row_limit, true);
+      ::ExecutorFinish(qd);
+      ::ExecutorEnd(qd);
+      ::FreeQueryDesc(qd);
+
+      ::PopActiveSnapshot();
+      ::MemoryContextSwitchTo(old_ctx);
+
+      if (!options->read_only) {
+        ::CommandCounterIncrement();
+      }
+    })(source.c_str(), arguments.type_oids(), static_cast<int>(sizeof...(Args)), param_info,
+       &options, dest, returns_rows, statement_ctx);
+  }
+
+  alloc_set_memory_context ctx;
+};
+
+} // namespace cppgres
@@ -4,15 +4,39 @@
 #include "guard.h"
 #include "memory.h"
 #include "types.h"
+#include "utils/aggregate.h"
 #include "utils/expected.h"
+#include "utils/generator.h"
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <exception>
 #include <expected>
+#include <format>
+#include <functional>
 #include <iterator>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 extern "C" {
+#include <access/htup_details.h>
+#include <catalog/namespace.h>
 #include <executor/spi.h>
+#include <nodes/makefuncs.h>
+#include <storage/lockdefs.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/regproc.h>
 }
 
 namespace cppgres {
@@ -31,6 +55,471 @@ concept datumable_tuple = requires {
   typename std::tuple_size<T>::type;
 } && all_convertible_from_nullable<T>(std::make_index_sequence<std::tuple_size_v<T>>{});
 
+template <typename Tie> struct record_fields;
+template <typename... Fields> struct record_fields<std::tuple<Fields &...>> {
+  using type = std::tuple<Fields...>;
+};
+
+/**
+ * Tuple of the field types of the aggregate `T`
+ */
+template <typename T>
+using record_fields_t =
+    typename record_fields<decltype(utils::tie_fields(std::declval<T &>()))>::type;
+
+/**
+ * Aggregate struct whose fields can be decoded from query results
+ */
+template <typename T>
+concept record = std::is_aggregate_v<T> && !requires { typename std::tuple_size<T>::type; } &&
+                 requires { typename record_fields_t<T>; } && datumable_tuple<record_fields_t<T>>;
+
+/**
+ * Column names bound to the fields of `T`, in field order
+ *
+ * Specialize with a `static constexpr std::array<std::string_view, N> names` to decode
+ * results into `T` by column name; records without it are decoded by column position.
+ */
+template <typename T> struct field_names {};
+
+template <typename T>
+concept named_record = record<T> && requires {
+  { field_names<T>::names[0] } -> std::convertible_to<std::string_view>;
+};
+
+/**
+ * Maps the fields of `T` to the (zero-based) attributes of `tupdesc`
+ */
+template <record T> std::vector<int> map_fields(::TupleDesc tupdesc) {
+  constexpr std::size_t n = std::tuple_size_v<record_fields_t<T>>;
+  std::vector<int> mapping(n);
+  if constexpr (named_record<T>) {
+    static_assert(std::size(field_names<T>::names) == n,
+                  "field_names must name every field of the record");
+    for (std::size_t i = 0; i < n; i++) {
+      std::string name(field_names<T>::names[i]);
+      int attnum = ffi_guarded(::SPI_fnumber)(tupdesc, name.c_str());
+      if (attnum <= 0) {
+        throw std::out_of_range(std::format("no column named `{}`", name));
+      }
+      mapping[i] = attnum - 1;
+    }
+  } else {
+    if (tupdesc->natts != n) {
+      throw std::runtime_error(
+          std::format("expected {} return values, got {}", n, tupdesc->natts));
+    }
+    for (std::size_t i = 0; i < n; i++) {
+      mapping[i] = static_cast<int>(i);
+    }
+  }
+  return mapping;
+}
+
+/**
+ * Backend-local cache of SPI plans, keyed by query text and argument types
+ *
+ * Plans are kept with `SPI_keepplan`; an entry whose plan has been invalidated by the plan
+ * cache is prepared again the next time it is used.
+ */
+struct plan_cache {
+  struct entry {
+    std::string query;
+    std::vector<::Oid> types;
+    ::SPIPlanPtr plan = nullptr;
+
+    ::SPIPlanPtr get() {
+      if (plan != nullptr && !ffi_guarded(::SPI_plan_is_valid)(plan)) {
+        ffi_guarded(::SPI_freeplan)(plan);
+        plan = nullptr;
+        mappings.clear();
+      }
+      if (plan == nullptr) {
+        auto prepared = ffi_guarded(::SPI_prepare)(query.c_str(), static_cast<int>(types.size()),
+                                                   types.data());
+        if (prepared == nullptr) {
+          throw std::runtime_error(
+              std::format("can't prepare query: {}", ::SPI_result_code_string(SPI_result)));
+        }
+        ffi_guarded(::SPI_keepplan)(prepared);
+        plan = prepared;
+      }
+      return plan;
+    }
+
+    /**
+     * Mapping of the plan's result columns to the fields of `T`, computed on first use and
+     * computed again whenever the columns of `tupdesc` (names and types) differ from those it
+     * was computed for, as the plan cache can replan a query while executing it
+     */
+    template <record T> std::span<const int> field_mapping(::TupleDesc tupdesc) {
+      static constexpr char tag = 0;
+      auto it = std::find_if(mappings.begin(), mappings.end(),
+                             [](auto &m) { return m.type == &tag; });
+      if (it != mappings.end() && it->describes(tupdesc)) {
+        return it->mapping;
+      }
+      record_mapping m{&tag, {}, map_fields<T>(tupdesc)};
+      for (int i = 0; i < tupdesc->natts; i++) {
+        auto attr = TupleDescAttr(tupdesc, i);
+        m.columns.emplace_back(NameStr(attr->attname), attr->atttypid);
+      }
+      if (it != mappings.end()) {
+        *it = std::move(m);
+        return it->mapping;
+      }
+      return mappings.emplace_back(std::move(m)).mapping;
+    }
+
+  private:
+    struct record_mapping {
+      const void *type;
+      std::vector<std::pair<std::string, ::Oid>> columns;
+      std::vector<int> mapping;
+
+      bool describes(::TupleDesc tupdesc) const {
+        if (static_cast<std::size_t>(tupdesc->natts) != columns.size()) {
+          return false;
+        }
+        for (int i = 0; i < tupdesc->natts; i++) {
+          auto attr = TupleDescAttr(tupdesc, i);
+          if (attr->atttypid != columns[i].second || columns[i].first != NameStr(attr->attname)) {
+            return false;
+          }
+        }
+        return true;
+      }
+    };
+    std::vector<record_mapping> mappings;
+  };
+
+  static entry &lookup(std::string_view query, std::span<const ::Oid> types) {
+    static std::unordered_map<std::string, entry> entries;
+
+    std::string key(query);
+    key.push_back('\0');
+    key.append(reinterpret_cast<const char *>(types.data()), types.size_bytes());
+
+    auto [it, inserted] = entries.try_emplace(std::move(key));
+    if (inserted) {
+      it->second.query = query;
+      it->second.types.assign(types.begin(), types.end());
+    }
+    return it->second;
+  }
+};
+
+/**
+ * Converts already deformed attribute values into a tuple
+ *
+ * A null value for an element that is not an `std::optional` throws `null_datum_exception`.
+ */
+template <datumable_tuple T> T decode_datums(const ::Datum *values, const bool *isnull) {
+  T ret;
+  [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+    (([&] {
+       auto nd = nullable_datum(::NullableDatum{.value = values[Is], .isnull = isnull[Is]});
+       std::get<Is>(ret) = decode_datum<std::tuple_element_t<Is, T>>(nd);
+     }()),
+     ...);
+  }(std::make_index_sequence<std::tuple_size_v<T>>{});
+  return ret;
+}
+
+/**
+ * Converts already deformed attribute values into a tuple, taking every element from the
+ * attribute `mapping` assigns to it
+ */
+template <datumable_tuple T>
+T decode_datums(const ::Datum *values, const bool *isnull, std::span<const int> mapping) {
+  T ret;
+  [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+    (([&] {
+       auto att = mapping[Is];
+       auto nd = nullable_datum(::NullableDatum{.value = values[att], .isnull = isnull[att]});
+       std::get<Is>(ret) = decode_datum<std::tuple_element_t<Is, T>>(nd);
+     }()),
+     ...);
+  }(std::make_index_sequence<std::tuple_size_v<T>>{});
+  return ret;
+}
+
+/**
+ * Converts already deformed attribute values into the record `T`, taking the value of every
+ * field from the attribute `mapping` assigns to it
+ */
+template <record T>
+T decode_record(const ::Datum *values, const bool *isnull, std::span<const int> mapping) {
+  T ret{};
+  auto fields = utils::tie_fields(ret);
+  [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+    (([&] {
+       auto att = mapping[Is];
+       auto nd = nullable_datum(::NullableDatum{.value = values[att], .isnull = isnull[att]});
+       std::get<Is>(fields) = decode_datum<std::tuple_element_t<Is, record_fields_t<T>>>(nd);
+     }()),
+     ...);
+  }(std::make_index_sequence<std::tuple_size_v<record_fields_t<T>>>{});
+  return ret;
+}
+
+template <typename T>
+concept columnar = std::is_trivially_copyable_v<T> && std::default_initializable<T> &&
+                   convertible_from_nullable_datum<T>;
+
+/**
+ * Values of a single result column laid out contiguously
+ *
+ * Null values are zero-initialized in `values()`; `validity()` is a bitmap with a bit set
+ * for every non-null value.
+ */
+template <columnar T> struct column {
+  column(T *values, bits8 *validity, size_t size)
+      : _values(values), _validity(validity), _size(size) {}
+
+  std::span<const T> values() const { return {_values, _size}; }
+  std::span<const bits8> validity() const { return {_validity, (_size + 7) / 8}; }
+
+  bool is_null(size_t i) const { return (_validity[i / 8] & (1 << (i % 8))) == 0; }
+  std::optional<T> operator[](size_t i) const {
+    return is_null(i) ? std::nullopt : std::optional(_values[i]);
+  }
+  size_t size() const { return _size; }
+
+private:
+  T *_values;
+  bits8 *_validity;
+  size_t _size;
+};
+
+/**
+ * Query arguments converted into datums
+ *
+ * Argument type OIDs form a compile-time table; values and null flags live in fixed-size
+ * arrays, so binding arguments doesn't allocate and converts every argument exactly once.
+ */
+template <convertible_into_nullable_datum... Args> struct query_arguments {
+  static constexpr std::size_t size = sizeof...(Args);
+  static constexpr std::array<::Oid, size> types = {type_for<Args>().oid...};
+
+  std::array<::Datum, size> datums;
+  std::array<char, size> nulls;
+
+  explicit query_arguments(Args &...args) {
+    [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+      (([&] {
+         nullable_datum nd = into_nullable_datum(args);
+         nulls[Is] = nd.is_null() ? 'n' : ' ';
+         datums[Is] = nd.is_null() ? ::Datum(0) : static_cast<::Datum &>(nd);
+       }()),
+       ...);
+    }(std::make_index_sequence<size>{});
+  }
+
+  /**
+   * Argument type OIDs in the form SPI functions accept them
+   */
+  static ::Oid *type_oids() { return const_cast<::Oid *>(types.data()); }
+};
+
+template <typename T> struct tuple_query_arguments;
+
+template <convertible_into_nullable_datum... Ts>
+struct tuple_query_arguments<std::tuple<Ts...>> {
+  using type = query_arguments<Ts...>;
+
+  static type from(std::tuple<Ts...> &row) {
+    return std::apply([](Ts &...values) { return type(values...); }, row);
+  }
+};
+
+/**
+ * Tuple of values that can be bound as query arguments
+ */
+template <typename T>
+concept query_argument_tuple = requires { typename tuple_query_arguments<T>::type; };
+
+/**
+ * Converts a tuple into attribute values and null flags
+ */
+template <query_argument_tuple T> void encode_datums(T &row, ::Datum *values, bool *isnull) {
+  [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+    (([&] {
+       nullable_datum nd = into_nullable_datum(std::get<Is>(row));
+       isnull[Is] = nd.is_null();
+       values[Is] = nd.is_null() ? ::Datum(0) : static_cast<::Datum &>(nd);
+     }()),
+     ...);
+  }(std::make_index_sequence<std::tuple_size_v<T>>{});
+}
+
+/**
+ * Converts a tuple into attribute values and null flags, storing every element in the
+ * attribute `mapping` assigns to it; attributes no element is mapped to are null
+ */
+template <query_argument_tuple T>
+void encode_datums(T &row, ::Datum *values, bool *isnull, int natts, std::span<const int> mapping) {
+  std::fill_n(values, natts, ::Datum(0));
+  std::fill_n(isnull, natts, true);
+  [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+    (([&] {
+       auto att = mapping[Is];
+       nullable_datum nd = into_nullable_datum(std::get<Is>(row));
+       isnull[att] = nd.is_null();
+       values[att] = nd.is_null() ? ::Datum(0) : static_cast<::Datum &>(nd);
+     }()),
+     ...);
+  }(std::make_index_sequence<std::tuple_size_v<T>>{});
+}
+
+/**
+ * Converts the record `T` into attribute values and null flags, storing every field in the
+ * attribute `mapping` assigns to it; attributes no field is mapped to are null
+ */
+template <record T>
+  requires query_argument_tuple<record_fields_t<T>>
+void encode_record(T &row, ::Datum *values, bool *isnull, int natts, std::span<const int> mapping) {
+  std::fill_n(values, natts, ::Datum(0));
+  std::fill_n(isnull, natts, true);
+  auto fields = utils::tie_fields(row);
+  [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+    (([&] {
+       auto att = mapping[Is];
+       nullable_datum nd = into_nullable_datum(std::get<Is>(fields));
+       isnull[att] = nd.is_null();
+       values[att] = nd.is_null() ? ::Datum(0) : static_cast<::Datum &>(nd);
+     }()),
+     ...);
+  }(std::make_index_sequence<std::tuple_size_v<record_fields_t<T>>>{});
+}
+
+/**
+ * Parameter list built from `query_arguments`, stored inline rather than allocated
+ */
+template <std::size_t N> struct param_list {
+  template <typename... Args> explicit param_list(const query_arguments<Args...> &arguments) {
+    static_assert(sizeof...(Args) == N);
+    auto params = static_cast<::ParamListInfo>(*this);
+    std::memset(params, 0, offsetof(::ParamListInfoData, params));
+    params->numParams = N;
+    for (std::size_t i = 0; i < N; i++) {
+      params->params[i] = {.value = arguments.datums[i],
+                           .isnull = arguments.nulls[i] == 'n',
+                           .pflags = PARAM_FLAG_CONST,
+                           .ptype = arguments.types[i]};
+    }
+  }
+
+  operator ::ParamListInfo() { return reinterpret_cast<::ParamListInfo>(storage); }
+
+private:
+  alignas(::ParamListInfoData) std::byte
+      storage[offsetof(::ParamListInfoData, params) + N * sizeof(::ParamExternData)];
+};
+
+/**
+ * Destination receiver that decodes every tuple the executor produces and passes it to
+ * `func` right away, without materializing the result
+ *
+ * If `func` returns `bool`, returning `false` stops the execution. Exceptions thrown while
+ * decoding or by `func` stop the execution and are rethrown by `rethrow()`. Every row is
+ * decoded in a memory context that is reset before the next one, so values it references are
+ * only valid during the call of `func`.
+ */
+template <datumable_tuple Ret, typename Func> struct callback_receiver {
+  explicit callback_receiver(Func &func)
+      : func(&func), row_ctx(ffi_guarded(::AllocSetContextCreateInternal)(
+                         ::CurrentMemoryContext, "callback_receiver", ALLOCSET_DEFAULT_SIZES)) {
+    receiver.receiveSlot = receive_slot;
+    receiver.rStartup = startup;
+    receiver.rShutdown = [](::DestReceiver *) {};
+    receiver.rDestroy = [](::DestReceiver *) {};
+    receiver.mydest = ::DestNone;
+  }
+
+  callback_receiver(const callback_receiver &) = delete;
+
+  // deleting a memory context doesn't raise errors, so it needs no guard in a destructor
+  ~callback_receiver() { ::MemoryContextDelete(row_ctx); }
+
+  operator ::DestReceiver *() { return &receiver; }
+
+  uint64_t processed() const { return count; }
+
+  void rethrow() {
+    if (exception) {
+      std::rethrow_exception(std::exchange(exception, nullptr));
+    }
+  }
+
+private:
+  static callback_receiver *self(::DestReceiver *receiver) {
+    static_assert(std::is_standard_layout_v<callback_receiver>,
+                  "the receiver must be pointer-interconvertible with its first member");
+    return reinterpret_cast<callback_receiver *>(receiver);
+  }
+
+  static void startup(::DestReceiver *receiver, int, ::TupleDesc tupdesc) {
+    if (tupdesc->natts != std::tuple_size_v<Ret>) {
+      self(receiver)->exception = std::make_exception_ptr(std::runtime_error(std::format(
+          "expected {} return values, got {}", std::tuple_size_v<Ret>, tupdesc->natts)));
+    }
+  }
+
+  static bool receive_slot(::TupleTableSlot *slot, ::DestReceiver *receiver) {
+    auto r = self(receiver);
+    if (r->exception) {
+      return false;
+    }
+    try {
+      ffi_guarded(::MemoryContextReset)(r->row_ctx);
+      ffi_guarded(::slot_getallattrs)(slot);
+      std::optional<Ret> row;
+      {
+        memory_context_scope scope(r->row_ctx);
+        row.emplace(decode_datums<Ret>(slot->tts_values, slot->tts_isnull));
+      }
+      r->count++;
+      if constexpr (std::same_as<std::invoke_result_t<Func &, Ret &>, bool>) {
+        return std::invoke(*r->func, *row);
+      } else {
+        std::invoke(*r->func, *row);
+      }
+    } catch (...) {
+      r->exception = std::current_exception();
+      return false;
+    }
+    return true;
+  }
+
+  // must remain the first member: the executor only sees a pointer to it
+  ::DestReceiver receiver;
+  Func *func;
+  ::MemoryContext row_ctx;
+  uint64_t count = 0;
+  std::exception_ptr exception;
+};
+
+/**
+ * Options for executing queries through `spi_executor`
+ */
+struct execution_options {
+  /**
+   * Execute the query as read-only: no command counter increment and no new snapshot.
+   * Only valid for queries that don't modify the database.
+   */
+  bool read_only = false;
+  /**
+   * Maximum number of rows to return, 0 for no limit
+   */
+  uint64_t row_limit = 0;
+  /**
+   * Allow the planner to choose a parallel plan. Parallel execution is only possible
+   * without a row limit.
+   */
+  bool parallel_ok = true;
+};
+
 struct spi_executor : public executor {
   spi_executor() : before_spi(::CurrentMemoryContext) {
     ffi_guarded(::SPI_connect)();
@@ -39,148 +528,921 @@ struct spi_executor : public executor {
   }
   ~spi_executor() { ffi_guarded(::SPI_finish)(); }
 
+  /**
+   * Decodes a heap tuple, deforming it once and converting all attributes from the deformed
+   * values
+   *
+   * `tupdesc` must have as many attributes as `T`; callers check it once per result with
+   * `check_natts` rather than for every row.
+   */
+  template <datumable_tuple T> static T decode_row(::HeapTuple tuple, ::TupleDesc tupdesc) {
+    constexpr std::size_t natts = std::tuple_size_v<T>;
+    Assert(tupdesc->natts == natts);
+    std::array<::Datum, natts> values;
+    std::array<bool, natts> isnull;
+    ffi_guarded(::heap_deform_tuple)(tuple, tupdesc, values.data(), isnull.data());
+    return decode_datums<T>(values.data(), isnull.data());
+  }
+
+  /**
+   * Input iterator over SPI results
+   *
+   * The current row is decoded in place on first access and discarded when the iterator
+   * advances, so walking the results doesn't allocate. As copies of an iterator don't share
+   * the decoded row, it is single-pass; `results::random_access` offers multi-pass access.
+   */
   template <datumable_tuple T> struct result_iterator {
-    using iterator_category = std::random_access_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
     using value_type = T;
     using difference_type = std::ptrdiff_t;
+    using reference = T &;
 
-    ::SPITupleTable *tuptable;
-    size_t index;
-    mutable std::vector<std::optional<T>> tuples;
+    result_iterator() noexcept = default;
+    result_iterator(::SPITupleTable *tuptable, size_t index) noexcept
+        : tuptable(tuptable), index(index) {}
 
-    constexpr result_iterator() noexcept {}
+    T &operator*() const {
+      if (!row.has_value()) {
+        row.emplace(decode_row<T>(tuptable->vals[index], tuptable->tupdesc));
+      }
+      return *row;
+    }
+    T *operator->() const { return &**this; }
 
-    constexpr result_iterator(::SPITupleTable *tuptable) noexcept
-        : tuptable(tuptable), index(0),
-          tuples(std::vector<std::optional<T>>(tuptable->numvals, std::nullopt)) {
-      tuples.reserve(tuptable->numvals);
+    result_iterator &operator++() noexcept {
+      row.reset();
+      index++;
+      return *this;
     }
-    constexpr result_iterator(::SPITupleTable *tuptable, size_t n) noexcept
-        : tuptable(tuptable), index(n),
-          tuples(std::vector<std::optional<T>>(tuptable->numvals, std::nullopt)) {
-      tuples.reserve(tuptable->numvals);
+    result_iterator operator++(int) {
+      auto tmp = *this;
+      ++*this;
+      return tmp;
     }
 
-    bool operator==(size_t end_index) const { return index == end_index; }
-    bool operator!=(size_t end_index) const { return index != end_index; }
+    bool operator==(const result_iterator &other) const noexcept {
+      return tuptable == other.tuptable && index == other.index;
+    }
 
-    constexpr T &operator*() const { return this->operator[](static_cast<difference_type>(index)); }
+  private:
+    ::SPITupleTable *tuptable = nullptr;
+    size_t index = 0;
+    mutable std::optional<T> row;
+  };
 
-    constexpr result_iterator &operator++() noexcept {
-      index++;
-      return *this;
+  /**
+   * Random access iterator over SPI results
+   *
+   * Rows are decoded on every dereference and returned by value, so the iterator itself is
+   * just a position and is cheap to copy regardless of the size of the results.
+   */
+  template <datumable_tuple T> struct random_access_result_iterator {
+    using iterator_concept = std::random_access_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using reference = T;
+
+    random_access_result_iterator() noexcept = default;
+    random_access_result_iterator(::SPITupleTable *tuptable, size_t index) noexcept
+        : tuptable(tuptable), index(index) {}
+
+    T operator*() const { return decode_row<T>(tuptable->vals[index], tuptable->tupdesc); }
+    T operator[](difference_type n) const {
+      return decode_row<T>(tuptable->vals[index + n], tuptable->tupdesc);
     }
-    constexpr result_iterator operator++(int) noexcept {
+
+    random_access_result_iterator &operator++() noexcept {
       index++;
-      return this;
+      return *this;
     }
-
-    constexpr result_iterator &operator--() noexcept {
+    random_access_result_iterator operator++(int) noexcept {
+      auto tmp = *this;
       index++;
-      return this;
+      return tmp;
     }
-    constexpr result_iterator operator--(int) noexcept {
+    random_access_result_iterator &operator--() noexcept {
       index--;
-      return this;
+      return *this;
     }
-
-    constexpr result_iterator operator+(const difference_type n) const noexcept {
-      return result_iterator(tuptable, index + n);
+    random_access_result_iterator operator--(int) noexcept {
+      auto tmp = *this;
+      index--;
+      return tmp;
     }
 
-    result_iterator &operator+=(difference_type n) noexcept {
+    random_access_result_iterator &operator+=(difference_type n) noexcept {
       index += n;
-      return this;
+      return *this;
+    }
+    random_access_result_iterator &operator-=(difference_type n) noexcept {
+      index -= n;
+      return *this;
+    }
+    random_access_result_iterator operator+(difference_type n) const noexcept {
+      return random_access_result_iterator(tuptable, index + n);
+    }
+    friend random_access_result_iterator operator+(difference_type n,
+                                                   const random_access_result_iterator &it) {
+      return it + n;
+    }
+    random_access_result_iterator operator-(difference_type n) const noexcept {
+      return random_access_result_iterator(tuptable, index - n);
+    }
+    difference_type operator-(const random_access_result_iterator &other) const noexcept {
+      return static_cast<difference_type>(index) - static_cast<difference_type>(other.index);
     }
 
-    constexpr result_iterator operator-(difference_type n) const noexcept {
-      return result_iterator(tuptable, index - n);
+    bool operator==(const random_access_result_iterator &other) const noexcept {
+      return tuptable == other.tuptable && index == other.index;
+    }
+    auto operator<=>(const random_access_result_iterator &other) const noexcept {
+      return index <=> other.index;
     }
 
-    result_iterator &operator-=(difference_type n) noexcept {
-      index -= n;
-      return this;
+  private:
+    ::SPITupleTable *tuptable = nullptr;
+    size_t index = 0;
+  };
+
+  /**
+   * Random access view over SPI results, see `random_access_result_iterator`
+   */
+  template <datumable_tuple Ret> struct random_access_results {
+    ::SPITupleTable *table;
+
+    random_access_results(::SPITupleTable *table) : table(table) {}
+
+    random_access_result_iterator<Ret> begin() const {
+      return random_access_result_iterator<Ret>(table, 0);
+    }
+    random_access_result_iterator<Ret> end() const {
+      return random_access_result_iterator<Ret>(table, table->numvals);
     }
+    size_t size() const { return table->numvals; }
+
+    Ret operator[](size_t n) const { return decode_row<Ret>(table->vals[n], table->tupdesc); }
+  };
 
-    constexpr difference_type operator-(const result_iterator &other) const noexcept {
-      return index - other.index;
+  /**
+   * Column names of a result set resolved to attribute numbers
+   *
+   * Every name is looked up in the tuple descriptor only once; later lookups hit the
+   * resolved list.
+   */
+  struct column_names {
+    explicit column_names(::TupleDesc tupdesc) : tupdesc(tupdesc) {}
+
+    int resolve(std::string_view name) {
+      for (auto &[resolved_name, attnum] : resolved) {
+        if (resolved_name == name) {
+          return attnum;
+        }
+      }
+      std::string n(name);
+      int attnum = ffi_guarded(::SPI_fnumber)(tupdesc, n.c_str());
+      if (attnum <= 0) {
+        throw std::out_of_range(std::format("no column named `{}`", name));
+      }
+      resolved.emplace_back(std::move(n), attnum);
+      return attnum;
     }
 
-    T &operator[](difference_type n) const {
-      if (tuples.at(n).has_value()) {
-        return tuples.at(n).value();
+  private:
+    ::TupleDesc tupdesc;
+    std::vector<std::pair<std::string, int>> resolved;
+  };
+
+  /**
+   * Row whose attributes are extracted and converted only when accessed
+   *
+   * Fields accessed by index are converted once and kept for the lifetime of the row;
+   * fields accessed by name are converted on every access, with the name resolved once per
+   * result set.
+   */
+  template <datumable_tuple T> struct lazy_row {
+    lazy_row(::HeapTuple tuple, ::TupleDesc tupdesc, column_names *names)
+        : tuple(tuple), tupdesc(tupdesc), names(names) {}
+
+    template <std::size_t I> const std::tuple_element_t<I, T> &get() const {
+      auto &field = std::get<I>(fields);
+      if (!field.has_value()) {
+        auto nd = attribute(I + 1);
+        field.emplace(decode_datum<std::tuple_element_t<I, T>>(nd));
       }
-      T ret;
+      return *field;
+    }
+
+    /**
+     * Converts the value of column `name` into `U`
+     */
+    template <typename U>
+      requires convertible_from_nullable_datum<utils::remove_optional_t<U>>
+    U get(std::string_view name) const {
+      auto nd = attribute(names->resolve(name));
+      return decode_datum<U>(nd);
+    }
 
-      [&]<std::size_t... Is>(std::index_sequence<Is...>) {
-        (([&] {
-           bool isnull;
-           ::Datum value =
-               ffi_guarded(::SPI_getbinval)(tuptable->vals[n], tuptable->tupdesc, Is + 1, &isnull);
-           ::NullableDatum datum = {.value = value, .isnull = isnull};
-           auto nd = nullable_datum(datum);
-           std::get<Is>(ret) = std::optional(
-               from_nullable_datum<utils::remove_optional_t<std::tuple_element_t<Is, T>>>(nd));
-         }()),
-         ...);
+    /**
+     * Decodes all fields into `T`
+     */
+    T decode() const {
+      return [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+        return T(get<Is>()...);
       }(std::make_index_sequence<std::tuple_size_v<T>>{});
-      tuples.emplace(std::next(tuples.begin(), n), std::in_place, ret);
-      return tuples.at(n).value();
     }
 
-    constexpr bool operator==(const result_iterator &other) const noexcept {
-      return tuptable == other.tuptable && index == other.index;
+  private:
+    nullable_datum attribute(int attnum) const {
+      bool isnull;
+      ::Datum value = ffi_guarded([](::HeapTuple tuple, int attnum, ::TupleDesc tupdesc,
+                                     bool *isnull) {
+        return heap_getattr(tuple, attnum, tupdesc, isnull);
+      })(tuple, attnum, tupdesc, &isnull);
+      return nullable_datum(::NullableDatum{.value = value, .isnull = isnull});
     }
-    constexpr bool operator!=(const result_iterator &other) const noexcept {
-      return !(tuptable == other.tuptable && index == other.index);
+
+    template <std::size_t... Is>
+    static auto make_fields(std::index_sequence<Is...>)
+        -> std::tuple<std::optional<std::tuple_element_t<Is, T>>...>;
+
+    ::HeapTuple tuple;
+    ::TupleDesc tupdesc;
+    column_names *names;
+    mutable decltype(make_fields(std::make_index_sequence<std::tuple_size_v<T>>{})) fields;
+  };
+
+  /**
+   * View over SPI results yielding `lazy_row`s, see `results::lazy`
+   *
+   * Rows refer to the column names resolved by the view, so it is neither copyable nor
+   * movable and must outlive the rows it produced.
+   */
+  template <datumable_tuple Ret> struct lazy_results {
+    explicit lazy_results(::SPITupleTable *table) : table(table), names(table->tupdesc) {
+      check_natts<Ret>(table->tupdesc);
     }
-    constexpr bool operator<(const result_iterator &other) const noexcept {
-      return index < other.index;
+    lazy_results(const lazy_results &) = delete;
+
+    // single-pass for the same reason as `result_iterator`
+    struct iterator {
+      using iterator_category = std::input_iterator_tag;
+      using value_type = lazy_row<Ret>;
+      using difference_type = std::ptrdiff_t;
+      using reference = lazy_row<Ret> &;
+
+      iterator() noexcept = default;
+      iterator(lazy_results *results, size_t index) noexcept : results(results), index(index) {}
+
+      lazy_row<Ret> &operator*() const {
+        if (!row.has_value()) {
+          row.emplace(results->table->vals[index], results->table->tupdesc, &results->names);
+        }
+        return *row;
+      }
+      lazy_row<Ret> *operator->() const { return &**this; }
+
+      iterator &operator++() noexcept {
+        row.reset();
+        index++;
+        return *this;
+      }
+      iterator operator++(int) {
+        auto tmp = *this;
+        ++*this;
+        return tmp;
+      }
+
+      bool operator==(const iterator &other) const noexcept {
+        return results == other.results && index == other.index;
+      }
+
+    private:
+      lazy_results *results = nullptr;
+      size_t index = 0;
+      mutable std::optional<lazy_row<Ret>> row;
+    };
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, table->numvals); }
+    size_t size() const { return table->numvals; }
+
+  private:
+    ::SPITupleTable *table;
+    column_names names;
+  };
+
+  template <datumable_tuple Ret> struct results {
+    ::SPITupleTable *table;
+
+    results(::SPITupleTable *table) : table(table) {}
+
+    result_iterator<Ret> begin() const { return result_iterator<Ret>(table, 0); }
+    result_iterator<Ret> end() const { return result_iterator<Ret>(table, table->numvals); }
+    size_t size() const { return table->numvals; }
+
+    /**
+     * Opt-in random access to the results
+     */
+    random_access_results<Ret> random_access() const { return random_access_results<Ret>(table); }
+
+    /**
+     * Opt-in lazy decoding of the results: only the fields that are accessed are converted
+     */
+    lazy_results<Ret> lazy() const { return lazy_results<Ret>(table); }
+
+    template <std::size_t I>
+    using column_type = utils::remove_optional_t<std::tuple_element_t<I, Ret>>;
+
+    /**
+     * Decodes column `I` of all rows into a contiguous buffer allocated in `ctx`
+     */
+    template <std::size_t I>
+      requires columnar<column_type<I>>
+    cppgres::column<column_type<I>> column(abstract_memory_context &ctx) const {
+      using T = column_type<I>;
+      size_t n = table->numvals;
+      auto values = static_cast<T *>(ctx.alloc(n * sizeof(T)));
+      auto validity = static_cast<bits8 *>(ctx.alloc((n + 7) / 8));
+      std::fill_n(validity, (n + 7) / 8, 0);
+
+      // values are decoded as they are extracted; a conversion error is carried out of the
+      // guard rather than thrown through it
+      std::exception_ptr exception;
+      ffi_guarded([&]() {
+        for (size_t i = 0; i < n && !exception; i++) {
+          ::NullableDatum datum;
+          datum.value = heap_getattr(table->vals[i], I + 1, table->tupdesc, &datum.isnull);
+          try {
+            auto nd = nullable_datum(datum);
+            auto value = from_nullable_datum<T>(nd);
+            if (value.has_value()) {
+              values[i] = *value;
+              validity[i / 8] |= 1 << (i % 8);
+            } else {
+              values[i] = T();
+            }
+          } catch (...) {
+            exception = std::current_exception();
+          }
+        }
+      })();
+      if (exception) {
+        ctx.free(values);
+        ctx.free(validity);
+        std::rethrow_exception(exception);
+      }
+
+      return cppgres::column<T>(values, validity, n);
     }
-    constexpr bool operator>(const result_iterator &other) const noexcept {
-      return index > other.index;
+
+    /**
+     * Decodes column `I` of all rows into a contiguous buffer allocated in the current memory
+     * context
+     */
+    template <std::size_t I>
+      requires columnar<column_type<I>>
+    cppgres::column<column_type<I>> column() const {
+      memory_context ctx;
+      return column<I>(ctx);
     }
-    constexpr bool operator<=(const result_iterator &other) const noexcept {
-      return index <= other.index;
+  };
+
+  /**
+   * Rows of a query fetched through an SPI cursor, `batch_size` rows at a time.
+   *
+   * Only the current batch is kept in memory: fetching the next one releases the previous
+   * tuple table. Must not outlive the executor that opened it. A `batch_size` of 0 is treated
+   * as 1, as SPI would otherwise fetch all the remaining rows at once.
+   */
+  template <datumable_tuple Ret> struct cursor {
+    cursor(::Portal portal, std::size_t batch_size)
+        : portal(portal), name(portal->name),
+          batch_size(std::clamp<std::size_t>(batch_size, 1, std::numeric_limits<long>::max())) {}
+    cursor(const cursor &) = delete;
+    cursor(cursor &&other) noexcept
+        : portal(std::exchange(other.portal, nullptr)), name(std::move(other.name)),
+          batch_size(other.batch_size), batch(std::exchange(other.batch, nullptr)) {}
+
+    /**
+     * Closes the cursor, ignoring errors, as it may be destroyed while an error unwinds
+     */
+    ~cursor() {
+      try {
+        close();
+      } catch (...) {
+      }
     }
-    constexpr bool operator>=(const result_iterator &other) const noexcept {
-      return index >= other.index;
+
+    /**
+     * Fetches the next batch of rows, releasing the previous one.
+     *
+     * The returned results are only valid until the next fetch or until the cursor is closed.
+     */
+    results<Ret> fetch() {
+      release_batch();
+      ffi_guarded(::SPI_cursor_fetch)(portal, true, static_cast<long>(batch_size));
+      batch = SPI_tuptable;
+      check_natts<Ret>(batch->tupdesc);
+      return results<Ret>(batch);
     }
 
+    /**
+     * Closes the cursor and releases the last batch
+     *
+     * If the (sub)transaction the cursor was opened in has been aborted, the portal and the
+     * batch are already gone and are left alone.
+     */
+    void close() {
+      if (portal == nullptr) {
+        return;
+      }
+      auto p = std::exchange(portal, nullptr);
+      if (ffi_guarded(::GetPortalByName)(name.c_str()) != p) {
+        batch = nullptr;
+        return;
+      }
+      release_batch();
+      ffi_guarded(::SPI_cursor_close)(p);
+    }
+
+    struct iterator {
+      using iterator_category = std::input_iterator_tag;
+      using value_type = Ret;
+      using difference_type = std::ptrdiff_t;
+
+      iterator() = default;
+      explicit iterator(cursor *c) : c(c), index(0) { advance_batch(); }
+
+      Ret &operator*() const {
+        if (!row.has_value()) {
+          row.emplace(decode_row<Ret>(c->batch->vals[index], c->batch->tupdesc));
+        }
+        return *row;
+      }
+
+      iterator &operator++() {
+        row.reset();
+        if (++index >= c->batch->numvals) {
+          advance_batch();
+        }
+        return *this;
+      }
+      void operator++(int) { ++*this; }
+
+      bool operator==(std::default_sentinel_t) const {
+        return c == nullptr || c->batch == nullptr || c->batch->numvals == 0;
+      }
+
+    private:
+      void advance_batch() {
+        c->fetch();
+        index = 0;
+      }
+
+      cursor *c = nullptr;
+      std::size_t index = 0;
+      mutable std::optional<Ret> row;
+    };
+
+    iterator begin() { return iterator(this); }
+    std::default_sentinel_t end() const { return {}; }
+
   private:
+    void release_batch() {
+      if (batch != nullptr) {
+        ffi_guarded(::SPI_freetuptable)(batch);
+        batch = nullptr;
+      }
+    }
+
+    ::Portal portal;
+    std::string name;
+    std::size_t batch_size;
+    ::SPITupleTable *batch = nullptr;
   };
 
-  template <datumable_tuple Ret> struct results {
-    ::SPITupleTable *table;
+  /**
+   * Opens a cursor for `query` that fetches its rows `batch_size` at a time
+   */
+  template <datumable_tuple Ret, convertible_into_nullable_datum... Args>
+  cursor<Ret> query_cursor(std::string_view query, std::size_t batch_size, Args &&...args) {
+    query_arguments<std::remove_cvref_t<Args>...> arguments(args...);
+    auto portal = ffi_guarded(::SPI_cursor_open_with_args)(
+        nullptr, query.data(), arguments.size, arguments.type_oids(), arguments.datums.data(),
+        arguments.nulls.data(), false, 0);
+    return cursor<Ret>(portal, batch_size);
+  }
 
-    results(::SPITupleTable *table) : table(table) {}
+  /**
+   * Lazily produces the rows of `query` as they are consumed
+   *
+   * The cursor is opened on first resumption, rows are fetched `batch_size` at a time, and
+   * the cursor is closed when the generator is destroyed, so stopping early (with `break` or
+   * `std::views::take`) doesn't run the query to completion. The query and the arguments are
+   * copied into the generator; it must not outlive the executor.
+   */
+  template <datumable_tuple Ret, convertible_into_nullable_datum... Args>
+  utils::generator<Ret> stream(std::string query, std::size_t batch_size, Args... args) {
+    auto rows = query_cursor<Ret>(query, batch_size, args...);
+    for (auto &row : rows) {
+      co_yield row;
+    }
+  }
 
-    result_iterator<Ret> begin() const { return result_iterator<Ret>(table); }
-    size_t end() const { return table->numvals; }
+  /**
+   * Statement prepared once and kept for the lifetime of the backend
+   *
+   * Obtained through `spi_executor::prepare`; executing it skips parsing and planning.
+   */
+  template <typename Ret, convertible_into_nullable_datum... Args>
+    requires datumable_tuple<Ret> || record<Ret>
+  struct prepared_statement {
+    explicit prepared_statement(plan_cache::entry &entry) : entry(entry) {}
+
+    /**
+     * Executes the statement
+     *
+     * Returns `results` for tuples and a vector of records for records. The binding of
+     * columns to record fields is kept with the plan for as long as its result columns stay
+     * the same.
+     */
+    auto execute(Args... args) {
+      query_arguments<Args...> arguments(args...);
+      auto rc = ffi_guarded(::SPI_execute_plan)(entry.get(), arguments.datums.data(),
+                                                arguments.nulls.data(), false, 0);
+      if (rc != SPI_OK_SELECT) {
+        throw std::runtime_error("spi error");
+      }
+      if constexpr (record<Ret>) {
+        return decode_records<Ret>(SPI_tuptable,
+                                   entry.field_mapping<Ret>(SPI_tuptable->tupdesc));
+      } else {
+        check_natts<Ret>(SPI_tuptable->tupdesc);
+        return results<Ret>(SPI_tuptable);
+      }
+    }
+
+    auto operator()(Args... args) { return execute(args...); }
+
+    /**
+     * Executes the statement, passing every row to `func` as it is produced
+     *
+     * Returns the number of rows passed.
+     */
+    template <typename Func>
+      requires datumable_tuple<Ret> && std::invocable<Func &, Ret &>
+    uint64_t for_each(Func &&func, Args... args) {
+      query_arguments<Args...> arguments(args...);
+      return execute_into<Ret>(entry.get(), arguments, execution_options{}, func);
+    }
+
+    ::SPIPlanPtr plan() { return entry.get(); }
+
+  private:
+    plan_cache::entry &entry;
   };
 
+  /**
+   * Prepares `query` for arguments of types `Args`
+   *
+   * Plans are cached per backend, keyed by the query text and argument types, so preparing
+   * the same query again returns the already prepared plan.
+   */
+  template <typename Ret, convertible_into_nullable_datum... Args>
+    requires datumable_tuple<Ret> || record<Ret>
+  prepared_statement<Ret, Args...> prepare(std::string_view query) {
+    return prepared_statement<Ret, Args...>(
+        plan_cache::lookup(query, query_arguments<Args...>::types));
+  }
+
+  /**
+   * Executes `query`, passing every row to `func` as the executor produces it
+   *
+   * Rows are not materialized, so memory use doesn't depend on the number of rows. If `func`
+   * returns `bool`, returning `false` stops the execution. Returns the number of rows passed.
+   */
+  template <datumable_tuple Ret, typename Func, convertible_into_nullable_datum... Args>
+    requires std::invocable<Func &, Ret &>
+  uint64_t for_each(std::string_view query, Func &&func, Args &&...args) {
+    return for_each<Ret>(execution_options{}, query, std::forward<Func>(func),
+                         std::forward<Args>(args)...);
+  }
+
+  template <datumable_tuple Ret, typename Func, convertible_into_nullable_datum... Args>
+    requires std::invocable<Func &, Ret &>
+  uint64_t for_each(const execution_options &options, std::string_view query, Func &&func,
+                    Args &&...args) {
+    query_arguments<std::remove_cvref_t<Args>...> arguments(args...);
+    auto plan = ffi_guarded(::SPI_prepare_cursor)(query.data(), arguments.size,
+                                                  arguments.type_oids(),
+                                                  options.parallel_ok ? CURSOR_OPT_PARALLEL_OK : 0);
+    if (plan == nullptr) {
+      throw std::runtime_error(
+          std::format("can't prepare query: {}", ::SPI_result_code_string(SPI_result)));
+    }
+    try {
+      auto processed = execute_into<Ret>(plan, arguments, options, func);
+      ffi_guarded(::SPI_freeplan)(plan);
+      return processed;
+    } catch (...) {
+      ffi_guarded(::SPI_freeplan)(plan);
+      throw;
+    }
+  }
+
+  /**
+   * Executes `query` once for every tuple of arguments in `rows`
+   *
+   * The query is prepared once for the call and every execution binds the next tuple against
+   * the same plan, which is freed afterwards. Returns the total number of rows processed.
+   */
+  template <std::ranges::input_range R>
+    requires query_argument_tuple<std::ranges::range_value_t<R>>
+  uint64_t execute_many(std::string_view query, R &&rows) {
+    using row_type = std::ranges::range_value_t<R>;
+    using arguments_type = typename tuple_query_arguments<row_type>::type;
+
+    auto plan = prepare_plan(query, arguments_type::types);
+    try {
+      uint64_t processed = 0;
+      for (auto &&r : rows) {
+        row_type row = r;
+        auto arguments = tuple_query_arguments<row_type>::from(row);
+        auto rc = ffi_guarded(::SPI_execute_plan)(plan, arguments.datums.data(),
+                                                  arguments.nulls.data(), false, 0);
+        if (rc < 0) {
+          throw std::runtime_error(std::format("spi error: {}", ::SPI_result_code_string(rc)));
+        }
+        processed += SPI_processed;
+        ffi_guarded(::SPI_freetuptable)(SPI_tuptable);
+      }
+      ffi_guarded(::SPI_freeplan)(plan);
+      return processed;
+    } catch (...) {
+      ffi_guarded(::SPI_freeplan)(plan);
+      throw;
+    }
+  }
+
+  /**
+   * Inserts `rows` into the leading columns of the table named `table` (optionally
+   * schema-qualified, as in SQL) using multi-row `INSERT ... VALUES` statements of up to
+   * `chunk_size` rows each
+   *
+   * See `insert_many(::Oid, R &&, std::size_t)`.
+   */
+  template <std::ranges::input_range R>
+    requires query_argument_tuple<std::ranges::range_value_t<R>>
+  uint64_t insert_many(std::string_view table, R &&rows, std::size_t chunk_size = 1000) {
+    auto oid = ffi_guarded([](const char *name) {
+      return ::RangeVarGetRelid(
+          ::makeRangeVarFromNameList(::stringToQualifiedNameList(name, nullptr)),
+          RowExclusiveLock, false);
+    })(std::string(table).c_str());
+    return insert_many(oid, std::forward<R>(rows), chunk_size);
+  }
+
+  /**
+   * Inserts `rows` into the leading columns of the table `table` using multi-row
+   * `INSERT ... VALUES` statements of up to `chunk_size` rows each
+   *
+   * The statement for a full chunk is prepared once for the call and freed afterwards; the
+   * last, shorter chunk is executed as a one-off statement. `chunk_size` is capped so that a
+   * statement has at most 65535 parameters. Returns the number of rows inserted.
+   */
+  template <std::ranges::input_range R>
+    requires query_argument_tuple<std::ranges::range_value_t<R>>
+  uint64_t insert_many(::Oid table, R &&rows, std::size_t chunk_size = 1000) {
+    using row_type = std::ranges::range_value_t<R>;
+    using arguments_type = typename tuple_query_arguments<row_type>::type;
+    constexpr std::size_t ncols = arguments_type::size;
+    static_assert(ncols > 0, "rows must have at least one column");
+
+    auto name = qualified_relation_name(table);
+    chunk_size = std::clamp<std::size_t>(chunk_size, 1, 65535 / ncols);
+
+    std::vector<::Oid> types;
+    types.reserve(chunk_size * ncols);
+    for (std::size_t i = 0; i < chunk_size; i++) {
+      types.insert(types.end(), arguments_type::types.begin(), arguments_type::types.end());
+    }
+
+    std::vector<::Datum> datums;
+    std::vector<char> nulls;
+    datums.reserve(chunk_size * ncols);
+    nulls.reserve(chunk_size * ncols);
+
+    uint64_t processed = 0;
+    std::size_t chunk_rows = 0;
+    ::SPIPlanPtr chunk_plan = nullptr;
+
+    auto flush = [&] {
+      int rc;
+      if (chunk_rows == chunk_size) {
+        if (chunk_plan == nullptr) {
+          chunk_plan = prepare_plan(insert_statement(name, ncols, chunk_size), types);
+        }
+        rc = ffi_guarded(::SPI_execute_plan)(chunk_plan, datums.data(), nulls.data(), false, 0);
+      } else {
+        auto stmt = insert_statement(name, ncols, chunk_rows);
+        rc = ffi_guarded(::SPI_execute_with_args)(stmt.c_str(), chunk_rows * ncols,
+                                                  types.data(), datums.data(), nulls.data(),
+                                                  false, 0);
+      }
+      if (rc < 0) {
+        throw std::runtime_error(std::format("spi error: {}", ::SPI_result_code_string(rc)));
+      }
+      processed += SPI_processed;
+      datums.clear();
+      nulls.clear();
+      chunk_rows = 0;
+    };
+
+    try {
+      for (auto &&r : rows) {
+        row_type row = r;
+        auto arguments = tuple_query_arguments<row_type>::from(row);
+        datums.insert(datums.end(), arguments.datums.begin(), arguments.datums.end());
+        nulls.insert(nulls.end(), arguments.nulls.begin(), arguments.nulls.end());
+        if (++chunk_rows == chunk_size) {
+          flush();
+        }
+      }
+      if (chunk_rows > 0) {
+        flush();
+      }
+    } catch (...) {
+      if (chunk_plan != nullptr) {
+        ffi_guarded(::SPI_freeplan)(chunk_plan);
+      }
+      throw;
+    }
+    if (chunk_plan != nullptr) {
+      ffi_guarded(::SPI_freeplan)(chunk_plan);
+    }
+    return processed;
+  }
+
   template <datumable_tuple Ret, convertible_into_nullable_datum... Args>
   results<Ret> query(std::string_view query, Args &&...args) {
-    constexpr size_t nargs = sizeof...(Args);
-    constexpr ::Oid types[nargs] = {type_for<Args...>().oid};
-    ::Datum datums[nargs] = {into_nullable_datum(args...)};
-    const char nulls[nargs] = {into_nullable_datum(args...).is_null() ? 'n' : ' '};
-    auto rc = ffi_guarded(::SPI_execute_with_args)(query.data(), nargs, const_cast<::Oid *>(types),
-                                                   datums, nulls, false, 0);
-    if (rc == SPI_OK_SELECT) {
-      auto natts = SPI_tuptable->tupdesc->natts;
-      if (natts != std::tuple_size_v<Ret>) {
+    return this->query<Ret>(execution_options{}, query, std::forward<Args>(args)...);
+  }
+
+  template <datumable_tuple Ret, convertible_into_nullable_datum... Args>
+  results<Ret> query(const execution_options &options, std::string_view query, Args &&...args) {
+    query_arguments<std::remove_cvref_t<Args>...> arguments(args...);
+    auto table = execute_query(options, query, arguments);
+    check_natts<Ret>(table->tupdesc);
+    return results<Ret>(table);
+  }
+
+  /**
+   * Executes `query`, decoding the rows into records
+   *
+   * Columns are bound to fields by name if `T` has `field_names`, and by position otherwise.
+   * The binding is resolved once for the result set.
+   */
+  template <record Ret, convertible_into_nullable_datum... Args>
+  std::vector<Ret> query(std::string_view query, Args &&...args) {
+    return this->query<Ret>(execution_options{}, query, std::forward<Args>(args)...);
+  }
+
+  template <record Ret, convertible_into_nullable_datum... Args>
+  std::vector<Ret> query(const execution_options &options, std::string_view query,
+                         Args &&...args) {
+    query_arguments<std::remove_cvref_t<Args>...> arguments(args...);
+    auto table = execute_query(options, query, arguments);
+    return decode_records<Ret>(table, map_fields<Ret>(table->tupdesc));
+  }
+
+private:
+  template <typename... Args>
+  static ::SPITupleTable *execute_query(const execution_options &options, std::string_view query,
+                                        query_arguments<Args...> &arguments) {
+    int rc;
+    if (options.parallel_ok) {
+      // one-shot plan, always planned with `CURSOR_OPT_PARALLEL_OK`
+      rc = ffi_guarded(::SPI_execute_with_args)(
+          query.data(), arguments.size, arguments.type_oids(), arguments.datums.data(),
+          arguments.nulls.data(), options.read_only, static_cast<long>(options.row_limit));
+    } else {
+      auto plan = ffi_guarded(::SPI_prepare_cursor)(query.data(), arguments.size,
+                                                    arguments.type_oids(), 0);
+      if (plan == nullptr) {
         throw std::runtime_error(
-            std::format("expected %d return values, got %d", std::tuple_size_v<Ret>, natts));
+            std::format("can't prepare query: {}", ::SPI_result_code_string(SPI_result)));
       }
-      //      static_assert(std::random_access_iterator<result_iterator<Ret>>);
-      return results<Ret>(SPI_tuptable);
-    } else {
+      try {
+        rc = ffi_guarded(::SPI_execute_plan)(plan, arguments.datums.data(),
+                                             arguments.nulls.data(), options.read_only,
+                                             static_cast<long>(options.row_limit));
+      } catch (...) {
+        ffi_guarded(::SPI_freeplan)(plan);
+        throw;
+      }
+      ffi_guarded(::SPI_freeplan)(plan);
+    }
+    if (rc != SPI_OK_SELECT) {
       throw std::runtime_error("spi error");
     }
+    return SPI_tuptable;
+  }
+
+  /**
+   * Decodes all rows of `table` into records and releases it
+   */
+  template <record Ret>
+  static std::vector<Ret> decode_records(::SPITupleTable *table, std::span<const int> mapping) {
+    auto natts = table->tupdesc->natts;
+    std::vector<::Datum> values(natts);
+    auto isnull = std::make_unique<bool[]>(natts);
+    std::vector<Ret> rows;
+    rows.reserve(table->numvals);
+    for (uint64_t i = 0; i < table->numvals; i++) {
+      ffi_guarded(::heap_deform_tuple)(table->vals[i], table->tupdesc, values.data(),
+                                       isnull.get());
+      rows.push_back(decode_record<Ret>(values.data(), isnull.get(), mapping));
+    }
+    ffi_guarded(::SPI_freetuptable)(table);
+    return rows;
+  }
+
+  template <datumable_tuple Ret, typename Func, typename... Args>
+  static uint64_t execute_into(::SPIPlanPtr plan, const query_arguments<Args...> &arguments,
+                               const execution_options &options, Func &func) {
+    callback_receiver<Ret, Func> receiver(func);
+    param_list<sizeof...(Args)> params(arguments);
+    ::SPIExecuteOptions opts;
+    std::memset(&opts, 0, sizeof(opts));
+    opts.params = sizeof...(Args) > 0 ? static_cast<::ParamListInfo>(params) : nullptr;
+    opts.read_only = options.read_only;
+    opts.tcount = options.row_limit;
+    opts.dest = receiver;
+    auto rc = ffi_guarded(::SPI_execute_plan_extended)(plan, &opts);
+    receiver.rethrow();
+    if (rc < 0) {
+      throw std::runtime_error(std::format("spi error: {}", ::SPI_result_code_string(rc)));
+    }
+    return receiver.processed();
+  }
+
+  /**
+   * Prepares `query` without keeping the plan; the caller frees it with `SPI_freeplan`
+   */
+  static ::SPIPlanPtr prepare_plan(std::string_view query, std::span<const ::Oid> types) {
+    std::string source(query);
+    auto plan = ffi_guarded(::SPI_prepare)(source.c_str(), static_cast<int>(types.size()),
+                                           const_cast<::Oid *>(types.data()));
+    if (plan == nullptr) {
+      throw std::runtime_error(
+          std::format("can't prepare query: {}", ::SPI_result_code_string(SPI_result)));
+    }
+    return plan;
+  }
+
+  /**
+   * Schema-qualified name of the relation `oid`, quoted for use in SQL
+   */
+  static std::string qualified_relation_name(::Oid oid) {
+    auto name = ffi_guarded([](::Oid oid) -> char * {
+      auto relname = ::get_rel_name(oid);
+      if (relname == nullptr) {
+        return nullptr;
+      }
+      return ::quote_qualified_identifier(::get_namespace_name(::get_rel_namespace(oid)),
+                                          relname);
+    })(oid);
+    if (name == nullptr) {
+      throw std::runtime_error(std::format("relation {} does not exist", oid));
+    }
+    std::string result(name);
+    ffi_guarded(::pfree)(name);
+    return result;
+  }
+
+  static std::string insert_statement(std::string_view table, std::size_t ncols,
+                                      std::size_t nrows) {
+    std::string stmt = std::format("insert into {} values ", table);
+    std::size_t param = 1;
+    for (std::size_t row = 0; row < nrows; row++) {
+      stmt.append(row == 0 ? "(" : ", (");
+      for (std::size_t col = 0; col < ncols; col++) {
+        stmt.append(col == 0 ? "$" : ", $");
+        stmt.append(std::to_string(param++));
+      }
+      stmt.push_back(')');
+    }
+    return stmt;
+  }
+
+  template <datumable_tuple Ret> static void check_natts(::TupleDesc tupdesc) {
+    if (tupdesc->natts != std::tuple_size_v<Ret>) {
+      throw std::runtime_error(std::format("expected {} return values, got {}",
+                                           std::tuple_size_v<Ret>, tupdesc->natts));
+    }
   }
 
-private:
   ::MemoryContext before_spi;
   ::MemoryContext spi;
   alloc_set_memory_context ctx;
@@ -1,30 +1,65 @@
 #pragma once
 
 #include "datum.h"
+#include "executor.h"
 #include "guard.h"
 #include "imports.h"
 #include "types.h"
 #include "utils/function_traits.h"
 #include "utils/utils.h"
 
+#include <algorithm>
 #include <array>
-#include <iostream>
+#include <format>
+#include <span>
+#include <stdexcept>
 #include <tuple>
+#include <type_traits>
 #include <typeinfo>
+#include <utility>
+
+extern "C" {
+#include <access/htup_details.h>
+#include <funcapi.h>
+#include <utils/lsyscache.h>
+#include <utils/typcache.h>
+}
 
 namespace cppgres {
 
+/**
+ * Result returned as a composite value: a tuple of values, or a record whose fields are
+ * stored in the attributes of the same name (see `field_names`) or position
+ */
+template <typename T>
+concept composite_result =
+    query_argument_tuple<T> || (record<T> && query_argument_tuple<record_fields_t<T>>);
+
+template <typename T>
+concept function_result = convertible_into_nullable_datum<T> || composite_result<T>;
+
+/**
+ * Parameter taking a composite value (a row of a table or composite type, or a `record`):
+ * a tuple of values, or a record whose fields are taken from the attributes of the same name
+ * (see `field_names`) or position
+ */
+template <typename T>
+concept composite_argument = datumable_tuple<utils::remove_optional_t<std::remove_cvref_t<T>>> ||
+                             record<utils::remove_optional_t<std::remove_cvref_t<T>>>;
+
 template <typename Func>
-concept datumable_function =
+concept datumable_arguments =
     requires { typename utils::function_traits::function_traits<Func>::argument_types; } &&
     all_from_nullable_datum<
-        typename utils::function_traits::function_traits<Func>::argument_types>::value &&
-    requires(Func f) {
+        typename utils::function_traits::function_traits<Func>::argument_types>::value;
+
+template <typename Func>
+concept datumable_function = datumable_arguments<Func> && requires(Func f) {
       {
         std::apply(
             f,
             std::declval<typename utils::function_traits::function_traits<Func>::argument_types>())
-      } -> convertible_into_nullable_datum;
+      } -> function_result;
     };
 
 template <typename T> constexpr std::string_view type_name() {
@@ -51,6 +86,337 @@ template <typename T> constexpr std::string_view type_name() {
 #endif
 }
 
+template <typename T> struct composite_fields {
+  using type = T;
+};
+template <record T> struct composite_fields<T> {
+  using type = record_fields_t<T>;
+};
+
+/**
+ * Row type of a composite argument, with the mapping of its attributes and space to deform
+ * its values into
+ *
+ * Looked up on the first call and again only when a call passes a row of a different type,
+ * so decoding a row doesn't go through the type cache.
+ */
+struct row_argument {
+  ::Oid type;
+  int32 typmod;
+  ::TupleDesc tupdesc;
+  /**
+   * Attributes the fields of a record are taken from
+   */
+  int *mapping;
+  ::Datum *values;
+  bool *isnull;
+
+  /**
+   * Deforms the composite `datum` into `T`, keeping descriptors in `mcxt`
+   */
+  template <typename T>
+    requires composite_argument<T>
+  T decode(::Datum datum, ::MemoryContext mcxt) {
+    auto header = ffi_guarded([](::Datum datum) { return DatumGetHeapTupleHeader(datum); })(datum);
+    auto header_type = HeapTupleHeaderGetTypeId(header);
+    auto header_typmod = HeapTupleHeaderGetTypMod(header);
+    if (tupdesc == nullptr || type != header_type || typmod != header_typmod) {
+      describe<T>(header_type, header_typmod, mcxt);
+    }
+
+    ::HeapTupleData tuple;
+    tuple.t_len = HeapTupleHeaderGetDatumLength(header);
+    ItemPointerSetInvalid(&tuple.t_self);
+    tuple.t_tableOid = InvalidOid;
+    tuple.t_data = header;
+    ffi_guarded(::heap_deform_tuple)(&tuple, tupdesc, values, isnull);
+
+    if constexpr (record<T>) {
+      return decode_record<T>(
+          values, isnull, std::span<const int>(mapping, std::tuple_size_v<record_fields_t<T>>));
+    } else {
+      return decode_datums<T>(values, isnull);
+    }
+  }
+
+private:
+  template <typename T> void describe(::Oid row_type, int32 row_typmod, ::MemoryContext mcxt) {
+    auto desc = ffi_guarded([](::Oid row_type, int32 row_typmod, ::MemoryContext mcxt) {
+      auto cached = ::lookup_rowtype_tupdesc(row_type, row_typmod);
+      auto old_ctx = ::MemoryContextSwitchTo(mcxt);
+      auto copy = ::CreateTupleDescCopy(cached);
+      ::MemoryContextSwitchTo(old_ctx);
+      ReleaseTupleDesc(cached);
+      return copy;
+    })(row_type, row_typmod, mcxt);
+
+    int *fields = nullptr;
+    if constexpr (record<T>) {
+      auto m = map_fields<T>(desc);
+      fields = static_cast<int *>(ffi_guarded(::MemoryContextAlloc)(mcxt, m.size() * sizeof(int)));
+      std::ranges::copy(m, fields);
+    } else if (desc->natts != std::tuple_size_v<T>) {
+      throw std::runtime_error(std::format("expected a row of {} values, got {}",
+                                           std::tuple_size_v<T>, desc->natts));
+    }
+    using field_types = typename composite_fields<T>::type;
+    [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+      (([&] {
+         using ftyp =
+             utils::remove_optional_t<std::remove_cvref_t<std::tuple_element_t<Is, field_types>>>;
+         auto att = fields == nullptr ? static_cast<int>(Is) : fields[Is];
+         auto typ = cppgres::type{.oid = TupleDescAttr(desc, att)->atttypid};
+         if (!typ.template is<ftyp>()) {
+           throw std::runtime_error(
+               std::format("unexpected type of row attribute {}, can't convert `{}` into `{}`",
+                           att + 1, typ.name(), type_name<ftyp>()));
+         }
+       }()),
+       ...);
+    }(std::make_index_sequence<std::tuple_size_v<field_types>>{});
+
+    if (tupdesc != nullptr) {
+      ffi_guarded(::FreeTupleDesc)(tupdesc);
+      ffi_guarded(::pfree)(values);
+      ffi_guarded(::pfree)(isnull);
+      if (mapping != nullptr) {
+        ffi_guarded(::pfree)(mapping);
+      }
+    }
+    type = row_type;
+    typmod = row_typmod;
+    tupdesc = desc;
+    mapping = fields;
+    values = static_cast<::Datum *>(
+        ffi_guarded(::MemoryContextAlloc)(mcxt, desc->natts * sizeof(::Datum)));
+    isnull =
+        static_cast<bool *>(ffi_guarded(::MemoryContextAlloc)(mcxt, desc->natts * sizeof(bool)));
+  }
+};
+
+/**
+ * Converts the composite argument `nd` into `T`, using (and updating) the row type cached in
+ * `row`
+ */
+template <composite_argument T>
+T decode_row_argument(nullable_datum &nd, row_argument &row, ::MemoryContext mcxt) {
+  if (nd.is_null()) {
+    if constexpr (utils::is_optional<std::remove_cvref_t<T>>) {
+      return std::nullopt;
+    } else {
+      throw null_datum_exception();
+    }
+  }
+  return row.decode<utils::remove_optional_t<std::remove_cvref_t<T>>>(nd, mcxt);
+}
+
+template <typename Func>
+constexpr bool has_composite_arguments = []<typename... Args>(std::tuple<Args...> *) {
+  return (composite_argument<Args> || ...);
+}(static_cast<typename utils::function_traits::function_traits<Func>::argument_types *>(nullptr));
+
+/**
+ * Checks that the types of the arguments of the call, starting at `Offset`, can be
+ * converted into the parameter types of `Func`, reporting an error otherwise
+ */
+template <datumable_arguments Func, std::size_t Offset = 0>
+void check_argument_types(FunctionCallInfo fc) {
+  using traits = utils::function_traits::function_traits<Func>;
+  if (traits::arity + Offset != fc->nargs) {
+    report(ERROR, "expected %d arguments, got %d", static_cast<int>(traits::arity + Offset),
+           fc->nargs);
+  }
+  [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+    (([&] {
+       using ptyp = utils::remove_optional_t<
+           std::remove_cvref_t<std::tuple_element_t<Is, typename traits::argument_types>>>;
+       auto typ = type{.oid = ffi_guarded(::get_fn_expr_argtype)(fc->flinfo, Is + Offset)};
+       if constexpr (composite_argument<ptyp>) {
+         if (!ffi_guarded(::type_is_rowtype)(typ.oid)) {
+           report(ERROR, "unexpected type in position %d, can't convert `%s` into a row",
+                  Is + Offset, typ.name().data());
+         }
+       } else if (!typ.template is<ptyp>()) {
+         report(ERROR, "unexpected type in position %d, can't convert `%s` into `%.*s`",
+                Is + Offset, typ.name().data(), type_name<ptyp>().length(),
+                type_name<ptyp>().data());
+       }
+     }()),
+     ...);
+  }(std::make_index_sequence<traits::arity>{});
+}
+
+/**
+ * Converts the arguments of the call, starting at `Offset`, into the parameter types of
+ * `Func`, without checking their types
+ *
+ * Row types of composite arguments are cached in `rows` (indexed by parameter) if given, and
+ * looked up for this call only otherwise.
+ */
+template <datumable_arguments Func, std::size_t Offset = 0>
+auto convert_arguments(FunctionCallInfo fc, row_argument *rows = nullptr) ->
+    typename utils::function_traits::function_traits<Func>::argument_types {
+  using traits = utils::function_traits::function_traits<Func>;
+  typename traits::argument_types t;
+  if (traits::arity + Offset == fc->nargs) {
+    [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+      (([&] {
+         using ptyp = std::tuple_element_t<Is, typename traits::argument_types>;
+         auto nd = nullable_datum(fc->args[Is + Offset]);
+         if constexpr (composite_argument<ptyp>) {
+           if (rows != nullptr) {
+             std::get<Is>(t) = decode_row_argument<ptyp>(nd, rows[Is], fc->flinfo->fn_mcxt);
+           } else {
+             row_argument row{};
+             std::get<Is>(t) = decode_row_argument<ptyp>(nd, row, ::CurrentMemoryContext);
+           }
+         } else {
+           std::get<Is>(t) = decode_datum<ptyp>(nd);
+         }
+       }()),
+       ...);
+    }(std::make_index_sequence<traits::arity>{});
+  }
+  return t;
+}
+
+/**
+ * Checks the types of the arguments of the call and converts them into the parameter types
+ * of `Func`
+ */
+template <datumable_arguments Func>
+auto decode_arguments(FunctionCallInfo fc) ->
+    typename utils::function_traits::function_traits<Func>::argument_types {
+  check_argument_types<Func>(fc);
+  return convert_arguments<Func>(fc);
+}
+
+/**
+ * State of a call site of a function, kept in `flinfo->fn_extra` and allocated in
+ * `flinfo->fn_mcxt`, so it lives as long as the `FmgrInfo` it belongs to
+ */
+struct call_site {
+  /**
+   * Argument types have been checked against the parameter types of the function
+   */
+  bool arguments_checked;
+
+  /**
+   * Blessed descriptor of the composite result, set up on the first call returning a row
+   */
+  ::TupleDesc result_tupdesc;
+  /**
+   * Attribute values and null flags a result row is formed from
+   */
+  ::Datum *result_values;
+  bool *result_isnull;
+  /**
+   * Attributes of `result_tupdesc` the fields of a record result are stored in
+   */
+  int *result_mapping;
+
+  /**
+   * Row types of composite arguments, one per parameter
+   */
+  row_argument *row_arguments;
+
+  /**
+   * Returns the state of the call site of `fc`, creating it on first use
+   */
+  static call_site &of(FunctionCallInfo fc) {
+    if (fc->flinfo->fn_extra == nullptr) {
+      fc->flinfo->fn_extra =
+          ffi_guarded(::MemoryContextAllocZero)(fc->flinfo->fn_mcxt, sizeof(call_site));
+    }
+    return *static_cast<call_site *>(fc->flinfo->fn_extra);
+  }
+
+  /**
+   * Row type caches for the composite parameters of `Func`, or `nullptr` if it has none
+   */
+  template <typename Func> row_argument *rows(FunctionCallInfo fc) {
+    if constexpr (has_composite_arguments<Func>) {
+      if (row_arguments == nullptr) {
+        row_arguments = static_cast<row_argument *>(ffi_guarded(::MemoryContextAllocZero)(
+            fc->flinfo->fn_mcxt,
+            utils::function_traits::function_traits<Func>::arity * sizeof(row_argument)));
+      }
+      return row_arguments;
+    } else {
+      return nullptr;
+    }
+  }
+
+  /**
+   * Looks up the row type the function returns and maps the elements of `T` to its
+   * attributes
+   */
+  template <composite_result T> void describe_result(FunctionCallInfo fc) {
+    auto mcxt = fc->flinfo->fn_mcxt;
+    auto tupdesc = ffi_guarded([](FunctionCallInfo fc) {
+      ::TupleDesc tupdesc;
+      if (::get_call_result_type(fc, nullptr, &tupdesc) != ::TYPEFUNC_COMPOSITE) {
+        return ::TupleDesc(nullptr);
+      }
+      auto old_ctx = ::MemoryContextSwitchTo(fc->flinfo->fn_mcxt);
+      tupdesc = ::BlessTupleDesc(::CreateTupleDescCopy(tupdesc));
+      ::MemoryContextSwitchTo(old_ctx);
+      return tupdesc;
+    })(fc);
+    if (tupdesc == nullptr) {
+      throw std::runtime_error("function returning a row must be declared to return a row type");
+    }
+    if constexpr (query_argument_tuple<T>) {
+      if (tupdesc->natts != std::tuple_size_v<T>) {
+        throw std::runtime_error(std::format("expected {} return values, got {}",
+                                             std::tuple_size_v<T>, tupdesc->natts));
+      }
+    } else {
+      auto mapping = map_fields<T>(tupdesc);
+      result_mapping = static_cast<int *>(
+          ffi_guarded(::MemoryContextAlloc)(mcxt, mapping.size() * sizeof(int)));
+      std::ranges::copy(mapping, result_mapping);
+    }
+    result_values = static_cast<::Datum *>(
+        ffi_guarded(::MemoryContextAlloc)(mcxt, tupdesc->natts * sizeof(::Datum)));
+    result_isnull =
+        static_cast<bool *>(ffi_guarded(::MemoryContextAlloc)(mcxt, tupdesc->natts * sizeof(bool)));
+    result_tupdesc = tupdesc;
+  }
+};
+
+/**
+ * Converts the result of a call into a datum
+ *
+ * Tuples and records are formed into a row of the type the function is declared to return;
+ * its descriptor is looked up once per call site.
+ */
+template <function_result T> ::Datum result_datum(FunctionCallInfo fc, T &result) {
+  if constexpr (composite_result<T>) {
+    auto &site = call_site::of(fc);
+    if (site.result_tupdesc == nullptr) {
+      site.describe_result<T>(fc);
+    }
+    if constexpr (query_argument_tuple<T>) {
+      encode_datums(result, site.result_values, site.result_isnull);
+    } else {
+      encode_record(result, site.result_values, site.result_isnull, site.result_tupdesc->natts,
+                    std::span<const int>(site.result_mapping,
+                                         std::tuple_size_v<record_fields_t<T>>));
+    }
+    auto tuple =
+        ffi_guarded(::heap_form_tuple)(site.result_tupdesc, site.result_values, site.result_isnull);
+    return HeapTupleGetDatum(tuple);
+  } else {
+    nullable_datum nd = into_nullable_datum(result);
+    if (nd.is_null()) {
+      fc->isnull = true;
+      return ::Datum(0);
+    }
+    return nd;
+  }
+}
+
 template <datumable_function Func> struct postgres_function {
   Func func;
 
@@ -62,43 +428,98 @@ template <datumable_function Func> struct postgres_function {
   static constexpr std::size_t arity = traits::arity;
 
   auto operator()(FunctionCallInfo fc) -> ::Datum {
+    return exception_guarded([&] {
+      // argument types of a call site don't change, so they are only checked on the first call
+      auto &site = call_site::of(fc);
+      if (!site.arguments_checked) {
+        check_argument_types<Func>(fc);
+        site.arguments_checked = true;
+      }
+      argument_types t = convert_arguments<Func>(fc, site.rows<Func>(fc));
+      auto result = std::apply(func, t);
+      return result_datum(fc, result);
+    });
+  }
+};
 
-    argument_types t;
-    if (arity != fc->nargs) {
-      std::cout << "expected " << arity << " args" << std::endl;
-    } else {
+template <typename Tuple> struct strict_arguments;
+template <typename... Args> struct strict_arguments<std::tuple<Args...>> {
+  static constexpr bool value = (!utils::is_optional<std::remove_cvref_t<Args>> && ...);
+  static constexpr bool arithmetic = (std::is_arithmetic_v<std::remove_cvref_t<Args>> && ...);
+  template <typename Func>
+  static constexpr bool nothrow_invocable = std::is_nothrow_invocable_v<Func &, Args...>;
+};
 
-      [&]<std::size_t... Is>(std::index_sequence<Is...>) {
-        (([&] {
-           auto ptyp = remove_optional_t<std::remove_reference_t<decltype(std::get<Is>(t))>>();
-           auto typ = type{.oid = ffi_guarded(::get_fn_expr_argtype)(fc->flinfo, Is)};
-           if (!typ.template is<decltype(ptyp)>()) {
-             report(ERROR, "unexpected type in position %d, can't convert `%s` into `%.*s`", Is,
-                    typ.name().data(), type_name<decltype(ptyp)>().length(),
-                   type_name<decltype(ptyp)>().data());
-           }
-           std::get<Is>(t) = from_nullable_datum<decltype(ptyp)>(nullable_datum(fc->args[Is]));
-         }()),
-         ...);
-      }(std::make_index_sequence<std::tuple_size_v<decltype(t)>>{});
+template <typename Func>
+concept strict_datumable_function =
+    datumable_function<Func> &&
+    strict_arguments<typename utils::function_traits::function_traits<Func>::argument_types>::value;
+
+/**
+ * Wrapper for functions declared `STRICT`, whose parameters are all non-optional
+ *
+ * PostgreSQL never calls a strict function with null arguments, so argument values are
+ * read from `fc->args` without null checks. Argument types and the strictness of the
+ * function are verified once per call site. If `Func` is `noexcept` and only takes and
+ * returns arithmetic values, no exception handling is set up around the call.
+ */
+template <strict_datumable_function Func> struct postgres_strict_function {
+  Func func;
+
+  explicit postgres_strict_function(Func f) : func(f) {}
+
+  using traits = utils::function_traits::function_traits<Func>;
+  using argument_types = typename traits::argument_types;
+  using result_type = decltype(std::apply(std::declval<Func &>(), std::declval<argument_types>()));
+  static constexpr std::size_t arity = traits::arity;
+
+  // converting arithmetic values to and from datums can't fail
+  static constexpr bool nothrow =
+      strict_arguments<argument_types>::arithmetic &&
+      strict_arguments<argument_types>::template nothrow_invocable<Func> &&
+      std::is_arithmetic_v<std::remove_cvref_t<result_type>>;
+
+  auto operator()(FunctionCallInfo fc) -> ::Datum {
+    auto site = static_cast<call_site *>(fc->flinfo->fn_extra);
+    if (site == nullptr || !site->arguments_checked) [[unlikely]] {
+      check_call_site(fc);
+    }
+    if constexpr (nothrow) {
+      return call(fc);
+    } else {
+      return exception_guarded([&] { return call(fc); });
     }
+  }
 
+private:
+  static void check_call_site(FunctionCallInfo fc) {
     try {
-      auto result = std::apply(func, t);
-      nullable_datum nd = into_nullable_datum(result);
-
-      if (nd.is_null()) {
-        fc->isnull = true;
+      if (!fc->flinfo->fn_strict) {
+        report(ERROR, "function must be declared STRICT");
       }
-      return nd;
+      check_argument_types<Func>(fc);
+      call_site::of(fc).arguments_checked = true;
     } catch (const pg_exception &e) {
       error(e);
-    } catch (const std::exception &e) {
-      report(ERROR, "exception: %s", e.what());
-    } catch (...) {
-      report(ERROR, "some exception occurred");
     }
-    __builtin_unreachable();
+  }
+
+  ::Datum call(FunctionCallInfo fc) {
+    auto result = [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+      return func(
+          argument<std::remove_cvref_t<std::tuple_element_t<Is, argument_types>>, Is>(fc)...);
+    }(std::make_index_sequence<arity>{});
+    return result_datum(fc, result);
+  }
+
+  template <typename T, std::size_t I> static T argument(FunctionCallInfo fc) {
+    nullable_datum nd(fc->args[I].value);
+    if constexpr (composite_argument<T>) {
+      auto rows = static_cast<call_site *>(fc->flinfo->fn_extra)->rows<Func>(fc);
+      return rows[I].template decode<T>(nd, fc->flinfo->fn_mcxt);
+    } else {
+      return *from_nullable_datum<T>(nd);
+    }
   }
 };
 
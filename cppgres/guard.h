@@ -4,6 +4,7 @@ extern "C" {
 #include <setjmp.h>
 }
 
+#include <exception>
 #include <iostream>
 #include <utility>
 
@@ -63,4 +64,23 @@ template <typename Func> struct ffi_guard {
 
 template <typename Func> auto ffi_guarded(Func f) { return ffi_guard<Func>{f}; }
 
+/**
+ * Calls `f`, reporting exceptions that escape it as errors
+ *
+ * Functions called by PostgreSQL run their bodies through it, as C++ exceptions must not
+ * unwind into PostgreSQL.
+ */
+template <typename Func> auto exception_guarded(Func &&f) -> decltype(f()) {
+  try {
+    return f();
+  } catch (const pg_exception &e) {
+    error(e);
+  } catch (const std::exception &e) {
+    report(ERROR, "exception: %s", e.what());
+  } catch (...) {
+    report(ERROR, "some exception occurred");
+  }
+  __builtin_unreachable();
+}
+
 } // namespace cppgres
@@ -0,0 +1,309 @@
+#pragma once
+
+#include "executor.h"
+#include "guard.h"
+#include "table.h"
+#include "types.h"
+
+#include <algorithm>
+#include <format>
+#include <initializer_list>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <access/genam.h>
+#include <access/nbtree.h>
+#include <access/relscan.h>
+#include <access/skey.h>
+#include <access/stratnum.h>
+#include <catalog/pg_am.h>
+#include <utils/lsyscache.h>
+}
+
+namespace cppgres {
+
+enum class index_strategy : ::StrategyNumber {
+  less = BTLessStrategyNumber,
+  less_equal = BTLessEqualStrategyNumber,
+  equal = BTEqualStrategyNumber,
+  greater_equal = BTGreaterEqualStrategyNumber,
+  greater = BTGreaterStrategyNumber,
+};
+
+/**
+ * Condition on an index column, comparing it with a C++ value
+ *
+ * Values of types without a known type OID are compared as values of the column's operator
+ * class input type, which they must be convertible from.
+ */
+struct index_key {
+  template <convertible_into_nullable_datum T>
+  index_key(::AttrNumber column, index_strategy strategy, T value)
+      : column(column), strategy(strategy), type(type_for<T>().oid), accepts([](::Oid oid) {
+          return cppgres::type{.oid = oid}.template is<utils::remove_optional_t<T>>();
+        }) {
+    nullable_datum nd = into_nullable_datum(value);
+    if (nd.is_null()) {
+      throw std::invalid_argument("index keys can't be null");
+    }
+    datum = nd;
+  }
+
+  ::AttrNumber column;
+  index_strategy strategy;
+  ::Oid type;
+  bool (*accepts)(::Oid);
+  ::Datum datum;
+};
+
+/**
+ * Scan over a table through one of its btree indexes, bypassing SQL
+ *
+ * The scan is positioned with `equal` or `where` and then iterated; positioning it again
+ * restarts it. `probe` looks up a batch of keys in a single scan session. Rows are decoded
+ * into `Row` from the table, whose columns must match it (see `check_row_type`). Values
+ * referencing tuple data are only valid until the scan advances. Tables with row-level
+ * security enabled are not supported.
+ */
+template <datumable_tuple Row> struct index_scan {
+  index_scan(relation &&table, ::Oid index_oid) : table(std::move(table)) { init(index_oid); }
+  index_scan(std::string_view table, std::string_view index)
+      : index_scan(relation(table, AccessShareLock), lookup_index(index)) {}
+
+  index_scan(const index_scan &) = delete;
+
+  /**
+   * Ends the scan, ignoring errors, as it may be destroyed while an error unwinds
+   */
+  ~index_scan() {
+    try {
+      if (scan != nullptr) {
+        ffi_guarded(::index_endscan)(scan);
+      }
+      if (slot != nullptr) {
+        ffi_guarded(::ExecDropSingleTupleTableSlot)(slot);
+      }
+      if (snapshot != nullptr) {
+        ffi_guarded(::UnregisterSnapshot)(snapshot);
+      }
+      if (index != nullptr) {
+        ffi_guarded(::index_close)(index, AccessShareLock);
+      }
+    } catch (...) {
+    }
+  }
+
+  /**
+   * Positions the scan on rows whose leading index columns are equal to `keys`
+   */
+  template <convertible_into_nullable_datum... Keys> index_scan &equal(Keys... keys) {
+    static_assert(sizeof...(Keys) > 0, "at least one key is required");
+    ::AttrNumber column = 1;
+    return where({index_key(column++, index_strategy::equal, keys)...});
+  }
+
+  /**
+   * Positions the scan on rows matching all of `keys`
+   */
+  index_scan &where(std::initializer_list<index_key> keys) {
+    scan_keys.resize(keys.size());
+    std::size_t i = 0;
+    for (auto &key : keys) {
+      init_scan_key(scan_keys[i++], key);
+    }
+    rescan();
+    return *this;
+  }
+
+  /**
+   * Looks up every key in `keys` on the first index column, calling `func` with the key and
+   * every matching row
+   *
+   * Keys are sorted with the index's btree comparison function and probed in that order
+   * within a single scan, so that related index and heap pages are visited together; `func`
+   * sees the keys in index order rather than in the order given. Returns the number of
+   * matching rows.
+   */
+  template <convertible_into_nullable_datum Key, typename Func>
+    requires std::invocable<Func &, const Key &, Row &>
+  uint64_t probe(std::vector<Key> keys, Func &&func) {
+    if (keys.empty()) {
+      return 0;
+    }
+    std::vector<index_key> index_keys;
+    index_keys.reserve(keys.size());
+    for (auto &key : keys) {
+      index_keys.emplace_back(1, index_strategy::equal, key);
+    }
+    scan_keys.resize(1);
+    init_scan_key(scan_keys[0], index_keys[0]);
+    uint64_t matches = 0;
+    for (auto i : index_order(index_keys, scan_keys[0].sk_subtype)) {
+      scan_keys[0].sk_argument = index_keys[i].datum;
+      rescan();
+      for (auto &row : *this) {
+        matches++;
+        std::invoke(func, std::as_const(keys[i]), row);
+      }
+    }
+    return matches;
+  }
+
+  struct iterator {
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Row;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    explicit iterator(index_scan *scan) : scan(scan) { ++*this; }
+
+    Row &operator*() const {
+      if (!row.has_value()) {
+        row.emplace(decode_datums<Row>(scan->slot->tts_values, scan->slot->tts_isnull,
+                                       scan->columns));
+      }
+      return *row;
+    }
+
+    iterator &operator++() {
+      row.reset();
+      done = !ffi_guarded([](::IndexScanDesc scan, ::TupleTableSlot *slot) {
+        if (!::index_getnext_slot(scan, ::ForwardScanDirection, slot)) {
+          return false;
+        }
+        ::slot_getallattrs(slot);
+        return true;
+      })(scan->scan, scan->slot);
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    bool operator==(std::default_sentinel_t) const { return done; }
+
+  private:
+    index_scan *scan = nullptr;
+    bool done = true;
+    mutable std::optional<Row> row;
+  };
+
+  iterator begin() {
+    if (!positioned) {
+      throw std::logic_error("index scan must be positioned with `equal` or `where` first");
+    }
+    return iterator(this);
+  }
+  std::default_sentinel_t end() const { return {}; }
+
+private:
+  static ::Oid lookup_index(std::string_view name) {
+    return ffi_guarded([](const char *name) {
+      return ::RangeVarGetRelid(
+          ::makeRangeVarFromNameList(::stringToQualifiedNameList(name, nullptr)),
+          AccessShareLock, false);
+    })(std::string(name).c_str());
+  }
+
+  void init(::Oid index_oid) {
+    columns = check_row_type<Row>(table.tuple_descriptor(), row_access::read);
+    if (ffi_guarded(::pg_class_aclcheck)(table.oid(), ::GetUserId(), ACL_SELECT) !=
+        ::ACLCHECK_OK) {
+      throw std::runtime_error("permission denied");
+    }
+    if (ffi_guarded(::check_enable_rls)(table.oid(), InvalidOid, false) == RLS_ENABLED) {
+      throw std::runtime_error("scanning tables with row-level security is not supported");
+    }
+    index = ffi_guarded(::index_open)(index_oid, AccessShareLock);
+    if (index->rd_rel->relam != BTREE_AM_OID || index->rd_index->indrelid != table.oid()) {
+      auto message =
+          std::format("{} is not a btree index on the table", RelationGetRelationName(index));
+      ffi_guarded(::index_close)(std::exchange(index, nullptr), AccessShareLock);
+      throw std::runtime_error(message);
+    }
+    snapshot = ffi_guarded(::RegisterSnapshot)(ffi_guarded(::GetActiveSnapshot)());
+    slot = ffi_guarded(::table_slot_create)(table, nullptr);
+  }
+
+  void init_scan_key(::ScanKeyData &scan_key, const index_key &key) {
+    auto column = key.column;
+    if (column < 1 || column > IndexRelationGetNumberOfKeyAttributes(index)) {
+      throw std::out_of_range(std::format("index has no key column {}", column));
+    }
+    auto opfamily = index->rd_opfamily[column - 1];
+    auto opcintype = index->rd_opcintype[column - 1];
+    auto type = key.type;
+    if (type == InvalidOid) {
+      if (!key.accepts(opcintype)) {
+        throw std::runtime_error(
+            std::format("key of index column {} can't be compared as `{}`", column,
+                        ffi_guarded(::format_type_be)(opcintype)));
+      }
+      type = opcintype;
+    }
+    auto op = ffi_guarded(::get_opfamily_member)(opfamily, opcintype, type,
+                                                  static_cast<int16>(key.strategy));
+    if (op == InvalidOid) {
+      throw std::runtime_error(std::format("no operator to compare index column {} with `{}`",
+                                           column, ffi_guarded(::format_type_be)(type)));
+    }
+    auto proc = ffi_guarded(::get_opcode)(op);
+    ffi_guarded(::ScanKeyEntryInitialize)(
+        &scan_key, 0, column, static_cast<::StrategyNumber>(key.strategy), type,
+        index->rd_indcollation[column - 1], proc, key.datum);
+  }
+
+  /**
+   * Positions of `keys` sorted in the order of the first index column, or as given if the
+   * operator family has no comparison function for keys of type `type`
+   */
+  std::vector<std::size_t> index_order(const std::vector<index_key> &keys, ::Oid type) {
+    std::vector<std::size_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    ffi_guarded([](::Relation index, ::Oid type, const index_key *keys, std::size_t *order,
+                   std::size_t n) {
+      auto proc = ::get_opfamily_proc(index->rd_opfamily[0], type, type, BTORDER_PROC);
+      if (proc == InvalidOid) {
+        return;
+      }
+      ::FmgrInfo cmp;
+      ::fmgr_info(proc, &cmp);
+      auto collation = index->rd_indcollation[0];
+      std::sort(order, order + n, [&](std::size_t a, std::size_t b) {
+        return DatumGetInt32(::FunctionCall2Coll(&cmp, collation, keys[a].datum,
+                                                 keys[b].datum)) < 0;
+      });
+    })(index, type, keys.data(), order.data(), order.size());
+    return order;
+  }
+
+  void rescan() {
+    if (scan == nullptr) {
+      scan = ffi_guarded(::index_beginscan)(table, index, snapshot,
+                                            static_cast<int>(scan_keys.size()), 0);
+    } else if (scan->numberOfKeys != static_cast<int>(scan_keys.size())) {
+      ffi_guarded(::index_endscan)(scan);
+      scan = nullptr;
+      rescan();
+      return;
+    }
+    ffi_guarded(::index_rescan)(scan, scan_keys.data(), static_cast<int>(scan_keys.size()),
+                                nullptr, 0);
+    positioned = true;
+  }
+
+  relation table;
+  row_columns<Row> columns;
+  ::Relation index = nullptr;
+  ::Snapshot snapshot = nullptr;
+  ::TupleTableSlot *slot = nullptr;
+  ::IndexScanDesc scan = nullptr;
+  std::vector<::ScanKeyData> scan_keys;
+  bool positioned = false;
+};
+
+} // namespace cppgres
@@ -63,6 +63,25 @@ struct alloc_set_memory_context : public owned_memory_context {
 
 memory_context top_memory_context = memory_context(TopMemoryContext);
 
+/**
+ * Makes a memory context current for the lifetime of the object, restoring the previous one
+ * when it is destroyed, including when an exception unwinds
+ *
+ * Not for use inside `ffi_guarded` functions, whose errors skip destructors; the guard
+ * restores the memory context itself.
+ */
+struct memory_context_scope {
+  explicit memory_context_scope(::MemoryContext context)
+      : previous(::MemoryContextSwitchTo(context)) {}
+  memory_context_scope(const memory_context_scope &) = delete;
+  memory_context_scope &operator=(const memory_context_scope &) = delete;
+
+  ~memory_context_scope() { ::MemoryContextSwitchTo(previous); }
+
+private:
+  ::MemoryContext previous;
+};
+
 template <typename T>
 concept a_memory_context =
     std::derived_from<T, abstract_memory_context> && std::default_initializable<T>;
@@ -0,0 +1,245 @@
+#pragma once
+
+#include "datum.h"
+#include "error.h"
+#include "executor.h"
+#include "function.h"
+#include "guard.h"
+#include "memory.h"
+#include "utils/function_traits.h"
+
+#include <array>
+#include <format>
+#include <iterator>
+#include <new>
+#include <ranges>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include <funcapi.h>
+#include <miscadmin.h>
+#include <nodes/execnodes.h>
+#include <utils/tuplestore.h>
+}
+
+namespace cppgres {
+
+/**
+ * Row produced by a set-returning function: either a single value or a tuple of values
+ */
+template <typename T>
+concept set_returning_row = convertible_into_nullable_datum<T> || query_argument_tuple<T>;
+
+template <typename Func>
+concept set_returning_function_type =
+    datumable_arguments<Func> && requires(Func f) {
+      {
+        std::apply(
+            f,
+            std::declval<typename utils::function_traits::function_traits<Func>::argument_types>())
+      } -> std::ranges::input_range;
+    } &&
+    set_returning_row<std::ranges::range_value_t<decltype(std::apply(
+        std::declval<Func &>(),
+        std::declval<typename utils::function_traits::function_traits<Func>::argument_types>()))>>;
+
+enum class set_returning_mode {
+  /**
+   * The function is called once per row; the range is kept in `multi_call_memory_ctx` and
+   * advanced one row per call, so lazy producers stream with bounded memory
+   */
+  value_per_call,
+  /**
+   * The range is consumed in a single call and stored in a tuplestore, which suits
+   * producers that already hold all rows
+   */
+  materialize,
+};
+
+/**
+ * Set-returning function returning the rows of the range `Func` returns
+ *
+ * Ranges of tuples produce composite rows (`returns setof record`, `returns table (...)`);
+ * ranges of single values produce scalar rows.
+ */
+template <set_returning_function_type Func, set_returning_mode Mode>
+struct postgres_set_returning_function {
+  Func func;
+
+  explicit postgres_set_returning_function(Func f) : func(f) {}
+
+  using traits = utils::function_traits::function_traits<Func>;
+  using argument_types = typename traits::argument_types;
+  using range_type = std::remove_cvref_t<decltype(std::apply(std::declval<Func &>(),
+                                                             std::declval<argument_types>()))>;
+  using row_type = std::ranges::range_value_t<range_type>;
+
+  static constexpr bool composite = query_argument_tuple<row_type>;
+
+  auto operator()(FunctionCallInfo fc) -> ::Datum {
+    return exception_guarded([&] {
+      auto rsi = reinterpret_cast<::ReturnSetInfo *>(fc->resultinfo);
+      if (rsi == nullptr || !IsA(rsi, ReturnSetInfo)) {
+        throw std::runtime_error("set-valued function called in context that cannot accept a set");
+      }
+      if constexpr (Mode == set_returning_mode::value_per_call) {
+        return value_per_call(fc, rsi);
+      } else {
+        return materialize(fc, rsi);
+      }
+    });
+  }
+
+private:
+  /**
+   * Range being returned, together with its position
+   *
+   * Constructed in `multi_call_memory_ctx` and destroyed by a reset callback of that
+   * context, so it is released both when the set is exhausted and when the executor stops
+   * early.
+   */
+  struct state {
+    template <typename R>
+    explicit state(R &&range)
+        : range(std::forward<R>(range)), it(std::ranges::begin(this->range)),
+          end(std::ranges::end(this->range)) {}
+
+    range_type range;
+    std::ranges::iterator_t<range_type> it;
+    std::ranges::sentinel_t<range_type> end;
+    bool started = false;
+    ::MemoryContextCallback callback;
+  };
+  static_assert(alignof(state) <= MAXIMUM_ALIGNOF,
+                "ranges can't be more strictly aligned than palloc'd memory");
+
+  ::Datum value_per_call(FunctionCallInfo fc, ::ReturnSetInfo *rsi) {
+    if (!(rsi->allowedModes & SFRM_ValuePerCall)) {
+      throw std::runtime_error("value-per-call mode required, but it is not allowed in this "
+                               "context");
+    }
+    ::FuncCallContext *funcctx;
+    if (fc->flinfo->fn_extra == nullptr) {
+      funcctx = ffi_guarded(::init_MultiFuncCall)(fc);
+      memory_context_scope scope(funcctx->multi_call_memory_ctx);
+      if constexpr (composite) {
+        funcctx->tuple_desc = ffi_guarded(::BlessTupleDesc)(result_tupdesc(fc));
+      }
+      argument_types args = decode_arguments<Func>(fc);
+      auto memory = ffi_guarded(::palloc)(sizeof(state));
+      auto s = new (memory) state(std::apply(func, args));
+      s->callback.func = [](void *arg) { static_cast<state *>(arg)->~state(); };
+      s->callback.arg = s;
+      ffi_guarded(::MemoryContextRegisterResetCallback)(funcctx->multi_call_memory_ctx,
+                                                       &s->callback);
+      funcctx->user_fctx = s;
+    }
+    funcctx = ffi_guarded(::per_MultiFuncCall)(fc);
+    auto s = static_cast<state *>(funcctx->user_fctx);
+
+    {
+      memory_context_scope scope(funcctx->multi_call_memory_ctx);
+      // the current row stays alive until the next call, as generators may only yield
+      // references into their frame
+      if (s->started) {
+        ++s->it;
+      }
+      s->started = true;
+    }
+
+    if (s->it == s->end) {
+      ffi_guarded(::end_MultiFuncCall)(fc, funcctx);
+      rsi->isDone = ::ExprEndResult;
+      fc->isnull = true;
+      return ::Datum(0);
+    }
+
+    row_type row = *s->it;
+    funcctx->call_cntr++;
+    rsi->isDone = ::ExprMultipleResult;
+    if constexpr (composite) {
+      constexpr std::size_t natts = std::tuple_size_v<row_type>;
+      std::array<::Datum, natts> values;
+      std::array<bool, natts> isnull;
+      encode_datums(row, values.data(), isnull.data());
+      auto tuple = ffi_guarded(::heap_form_tuple)(funcctx->tuple_desc, values.data(),
+                                                  isnull.data());
+      return HeapTupleGetDatum(tuple);
+    } else {
+      nullable_datum nd = into_nullable_datum(row);
+      if (nd.is_null()) {
+        fc->isnull = true;
+        return ::Datum(0);
+      }
+      return nd;
+    }
+  }
+
+  ::Datum materialize(FunctionCallInfo fc, ::ReturnSetInfo *rsi) {
+    if (!(rsi->allowedModes & SFRM_Materialize)) {
+      throw std::runtime_error("materialize mode required, but it is not allowed in this "
+                               "context");
+    }
+    argument_types args = decode_arguments<Func>(fc);
+    auto range = std::apply(func, args);
+
+    ::TupleDesc tupdesc;
+    ::Tuplestorestate *tupstore;
+    {
+      memory_context_scope scope(rsi->econtext->ecxt_per_query_memory);
+      if constexpr (composite) {
+        tupdesc = ffi_guarded(::CreateTupleDescCopy)(result_tupdesc(fc));
+      } else {
+        tupdesc = ffi_guarded([](FunctionCallInfo fc) {
+          auto tupdesc = ::CreateTemplateTupleDesc(1);
+          ::TupleDescInitEntry(tupdesc, 1, "result", ::get_fn_expr_rettype(fc->flinfo), -1, 0);
+          return tupdesc;
+        })(fc);
+      }
+      tupstore = ffi_guarded(::tuplestore_begin_heap)(
+          (rsi->allowedModes & SFRM_Materialize_Random) != 0, false, ::work_mem);
+    }
+    rsi->returnMode = ::SFRM_Materialize;
+    rsi->setResult = tupstore;
+    rsi->setDesc = tupdesc;
+
+    constexpr std::size_t natts = [] {
+      if constexpr (composite) {
+        return std::tuple_size_v<row_type>;
+      } else {
+        return std::size_t(1);
+      }
+    }();
+    std::array<::Datum, natts> values;
+    std::array<bool, natts> isnull;
+    for (auto &&r : range) {
+      row_type row = r;
+      if constexpr (composite) {
+        encode_datums(row, values.data(), isnull.data());
+      } else {
+        nullable_datum nd = into_nullable_datum(row);
+        isnull[0] = nd.is_null();
+        values[0] = nd.is_null() ? ::Datum(0) : static_cast<::Datum &>(nd);
+      }
+      ffi_guarded(::tuplestore_putvalues)(tupstore, tupdesc, values.data(), isnull.data());
+    }
+    return ::Datum(0);
+  }
+
+  static ::TupleDesc result_tupdesc(FunctionCallInfo fc) {
+    ::TupleDesc tupdesc;
+    if (ffi_guarded(::get_call_result_type)(fc, nullptr, &tupdesc) != ::TYPEFUNC_COMPOSITE) {
+      throw std::runtime_error("function returning tuples must be declared to return a row type");
+    }
+    if (tupdesc->natts != std::tuple_size_v<row_type>) {
+      throw std::runtime_error(std::format("expected {} return values, got {}",
+                                           std::tuple_size_v<row_type>, tupdesc->natts));
+    }
+    return tupdesc;
+  }
+};
+
+} // namespace cppgres
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+/**
+ * Section of the shared library SQL declarations are collected in; `cppgres_sql_script`
+ * (CMake) turns its contents into an extension script
+ *
+ * Every declaration starts with a stage digit and a space; the script runs declarations in
+ * the order of their stages, so that objects are created after those they depend on.
+ */
+#ifdef __APPLE__
+#define CPPGRES_SQL_SECTION "__DATA,__cppgres_sql"
+#else
+#define CPPGRES_SQL_SECTION ".cppgres_sql"
+#endif
+
+namespace cppgres::sql {
+
+/**
+ * Null-terminated string of `N - 1` characters that can be concatenated at compile time
+ */
+template <std::size_t N> struct fixed_string {
+  char data[N]{};
+
+  constexpr fixed_string() = default;
+  constexpr fixed_string(const char (&s)[N]) { std::copy_n(s, N, data); }
+
+  constexpr std::size_t size() const { return N - 1; }
+
+  template <std::size_t M>
+  constexpr fixed_string<N + M - 1> operator+(const fixed_string<M> &other) const {
+    fixed_string<N + M - 1> result;
+    std::copy_n(data, N - 1, result.data);
+    std::copy_n(other.data, M, result.data + N - 1);
+    return result;
+  }
+};
+
+/**
+ * Stage prefixes of declarations
+ */
+inline constexpr fixed_string type_stage("1 ");
+inline constexpr fixed_string function_stage("2 ");
+inline constexpr fixed_string supported_function_stage("3 ");
+inline constexpr fixed_string aggregate_stage("4 ");
+
+template <std::size_t V> constexpr std::size_t digits = V < 10 ? 1 : 1 + digits<V / 10>;
+
+/**
+ * Decimal representation of `V`
+ */
+template <std::size_t V> constexpr auto number = [] {
+  fixed_string<digits<V> + 1> result;
+  auto v = V;
+  for (std::size_t i = digits<V>; i > 0; i--) {
+    result.data[i - 1] = static_cast<char>('0' + v % 10);
+    v /= 10;
+  }
+  return result;
+}();
+
+/**
+ * Function attributes the planner takes into account
+ */
+inline constexpr fixed_string immutable(" IMMUTABLE");
+inline constexpr fixed_string stable(" STABLE");
+inline constexpr fixed_string strict(" STRICT");
+inline constexpr fixed_string leakproof(" LEAKPROOF");
+inline constexpr fixed_string parallel_safe(" PARALLEL SAFE");
+inline constexpr fixed_string parallel_restricted(" PARALLEL RESTRICTED");
+inline constexpr fixed_string window(" WINDOW");
+
+/**
+ * Estimated execution cost, in units of `cpu_operator_cost`
+ */
+template <std::size_t Cost> constexpr auto cost = fixed_string(" COST ") + number<Cost>;
+
+/**
+ * Estimated number of rows a set-returning function returns
+ */
+template <std::size_t Rows> constexpr auto rows = fixed_string(" ROWS ") + number<Rows>;
+
+/**
+ * Clause referring to another function, which must be created first
+ */
+template <std::size_t N> struct function_reference : fixed_string<N> {
+  constexpr function_reference(const fixed_string<N> &clause) : fixed_string<N>(clause) {}
+};
+
+template <typename T> constexpr bool is_function_reference = false;
+template <std::size_t N> constexpr bool is_function_reference<function_reference<N>> = true;
+
+/**
+ * Planner support function (see `postgres_support_function`); functions declaring one are
+ * created after those that don't
+ */
+template <fixed_string Function>
+constexpr function_reference support{fixed_string(" SUPPORT ") + Function};
+
+/**
+ * `CREATE FUNCTION` statement for the C function `name`, whose `signature` is its parameter
+ * list followed by its `RETURNS` clause
+ *
+ * The library is referred to as `MODULE_PATHNAME`, as in extension scripts.
+ */
+template <std::size_t N, std::size_t M, typename... Attributes>
+constexpr auto create_function(const char (&name)[N], const char (&signature)[M],
+                               const Attributes &...attributes) {
+  auto stage = (is_function_reference<Attributes> || ...) ? supported_function_stage
+                                                           : function_stage;
+  auto statement = stage + fixed_string("CREATE FUNCTION ") + fixed_string(name) +
+                   fixed_string(signature) + fixed_string(" LANGUAGE c AS 'MODULE_PATHNAME', '") +
+                   fixed_string(name) + fixed_string("'");
+  return (statement + ... + attributes);
+}
+
+/**
+ * `CREATE TYPE` statement for the composite type `name`, whose `fields` are its parenthesized
+ * list of attributes
+ */
+template <std::size_t N, std::size_t M>
+constexpr auto create_composite_type(const char (&name)[N], const char (&fields)[M]) {
+  return type_stage + fixed_string("CREATE TYPE ") + fixed_string(name) + fixed_string(" AS ") +
+         fixed_string(fields);
+}
+
+/**
+ * `CREATE AGGREGATE` statement for the aggregate `name` over `arguments` (its parenthesized
+ * list of argument types), whose support functions are those `postgres_aggregate` defines
+ *
+ * The support functions must be declared as well.
+ */
+template <std::size_t N, std::size_t M>
+constexpr auto create_aggregate(const char (&name)[N], const char (&arguments)[M]) {
+  return aggregate_stage + fixed_string("CREATE AGGREGATE ") + fixed_string(name) +
+         fixed_string(arguments) + fixed_string(" (SFUNC = ") + fixed_string(name) +
+         fixed_string("_transfn, STYPE = internal, FINALFUNC = ") + fixed_string(name) +
+         fixed_string("_finalfn)");
+}
+
+/**
+ * `CREATE AGGREGATE` statement for the parallel safe aggregate `name` over `arguments`, whose
+ * support functions are those `postgres_parallel_aggregate` defines
+ *
+ * The support functions must be declared as well.
+ */
+template <std::size_t N, std::size_t M>
+constexpr auto create_parallel_aggregate(const char (&name)[N], const char (&arguments)[M]) {
+  return aggregate_stage + fixed_string("CREATE AGGREGATE ") + fixed_string(name) +
+         fixed_string(arguments) + fixed_string(" (SFUNC = ") + fixed_string(name) +
+         fixed_string("_transfn, STYPE = internal, FINALFUNC = ") + fixed_string(name) +
+         fixed_string("_finalfn, COMBINEFUNC = ") + fixed_string(name) +
+         fixed_string("_combinefn, SERIALFUNC = ") + fixed_string(name) +
+         fixed_string("_serialfn, DESERIALFUNC = ") + fixed_string(name) +
+         fixed_string("_deserialfn, PARALLEL = SAFE)");
+}
+
+} // namespace cppgres::sql
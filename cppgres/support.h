@@ -0,0 +1,209 @@
+#pragma once
+
+#include "datum.h"
+#include "error.h"
+#include "guard.h"
+#include "types.h"
+
+#include <optional>
+#include <type_traits>
+
+extern "C" {
+#include <nodes/makefuncs.h>
+#include <nodes/pg_list.h>
+#include <nodes/primnodes.h>
+#include <nodes/supportnodes.h>
+#include <utils/lsyscache.h>
+}
+
+namespace cppgres {
+
+/**
+ * Planner support request, giving typed access to the call being planned
+ */
+template <typename Req> struct support_request {
+  explicit support_request(Req *req) : req(req) {}
+
+  ::PlannerInfo *root() const { return req->root; }
+
+  /**
+   * Number of arguments of the call, or 0 if the planner didn't pass the call
+   */
+  int argument_count() const { return ::list_length(arguments()); }
+
+  /**
+   * Expression passed as argument `n`, or `nullptr` if there is no such argument
+   */
+  ::Node *argument(int n) const {
+    if (n < 0 || n >= argument_count()) {
+      return nullptr;
+    }
+    return static_cast<::Node *>(::list_nth(arguments(), n));
+  }
+
+  /**
+   * Value of argument `n` if it is a non-null constant of a type convertible into `T`
+   */
+  template <typename T>
+    requires convertible_from_nullable_datum<T>
+  std::optional<T> constant_argument(int n) const {
+    auto node = argument(n);
+    if (node == nullptr || !IsA(node, Const)) {
+      return std::nullopt;
+    }
+    auto c = reinterpret_cast<::Const *>(node);
+    if (c->constisnull || !type{.oid = c->consttype}.template is<T>()) {
+      return std::nullopt;
+    }
+    nullable_datum nd(c->constvalue);
+    return from_nullable_datum<T>(nd);
+  }
+
+  Req *operator->() const { return req; }
+
+protected:
+  ::List *arguments() const {
+    if constexpr (requires { req->args; }) {
+      return req->args;
+    } else if constexpr (requires { req->fcall; }) {
+      return req->fcall->args;
+    } else {
+      auto node = req->node;
+      if (node != nullptr && IsA(node, FuncExpr)) {
+        return reinterpret_cast<::FuncExpr *>(node)->args;
+      }
+      if (node != nullptr && IsA(node, OpExpr)) {
+        return reinterpret_cast<::OpExpr *>(node)->args;
+      }
+      return NIL;
+    }
+  }
+
+  Req *req;
+};
+
+/**
+ * Estimate of the number of rows a set-returning function returns
+ */
+struct rows_request : support_request<::SupportRequestRows> {
+  using support_request::support_request;
+};
+
+/**
+ * Estimate of the fraction of rows a boolean function (used as a predicate) accepts
+ */
+struct selectivity_request : support_request<::SupportRequestSelectivity> {
+  using support_request::support_request;
+
+  bool is_join() const { return req->is_join; }
+};
+
+struct cost_estimate {
+  ::Cost startup;
+  ::Cost per_tuple;
+};
+
+/**
+ * Estimate of the cost of calling the function, in the planner's cost units (the declared
+ * `COST` is instead multiplied by `cpu_operator_cost`)
+ */
+struct cost_request : support_request<::SupportRequestCost> {
+  using support_request::support_request;
+};
+
+/**
+ * Replacement of the call by a simpler expression
+ */
+struct simplify_request : support_request<::SupportRequestSimplify> {
+  using support_request::support_request;
+
+  /**
+   * Constant of the function's result type
+   */
+  template <convertible_into_nullable_datum T> ::Node *constant(T value) const {
+    nullable_datum nd = into_nullable_datum(value);
+    return ffi_guarded([](::FuncExpr *fcall, ::Datum value, bool isnull) {
+      int16 typlen;
+      bool typbyval;
+      ::get_typlenbyval(fcall->funcresulttype, &typlen, &typbyval);
+      return reinterpret_cast<::Node *>(::makeConst(fcall->funcresulttype, -1, fcall->funccollid,
+                                                    typlen, value, isnull, typbyval));
+    })(req->fcall, nd.is_null() ? ::Datum(0) : static_cast<::Datum &>(nd), nd.is_null());
+  }
+};
+
+/**
+ * Planner support function answering the requests `Handler` can be invoked with:
+ *
+ * - `std::optional<double>(rows_request &)`
+ * - `std::optional<Selectivity>(selectivity_request &)`
+ * - `std::optional<cost_estimate>(cost_request &)`
+ * - `Node *(simplify_request &)`, returning `nullptr` to keep the call
+ *
+ * An empty answer leaves the planner's default estimate in place. Other requests are
+ * declined.
+ */
+template <typename Handler>
+concept support_handler =
+    std::is_invocable_r_v<std::optional<double>, Handler &, rows_request &> ||
+    std::is_invocable_r_v<std::optional<::Selectivity>, Handler &, selectivity_request &> ||
+    std::is_invocable_r_v<std::optional<cost_estimate>, Handler &, cost_request &> ||
+    std::is_invocable_r_v<::Node *, Handler &, simplify_request &>;
+
+template <support_handler Handler> struct postgres_support_function {
+  Handler handler;
+
+  explicit postgres_support_function(Handler h) : handler(h) {}
+
+  auto operator()(FunctionCallInfo fc) -> ::Datum {
+    return exception_guarded([&] {
+      auto node = reinterpret_cast<::Node *>(DatumGetPointer(fc->args[0].value));
+      return ::PointerGetDatum(answer(node));
+    });
+  }
+
+private:
+  ::Node *answer(::Node *node) {
+    if constexpr (std::is_invocable_r_v<std::optional<double>, Handler &, rows_request &>) {
+      if (IsA(node, SupportRequestRows)) {
+        rows_request request(reinterpret_cast<::SupportRequestRows *>(node));
+        std::optional<double> rows = handler(request);
+        if (rows.has_value()) {
+          request->rows = *rows;
+          return node;
+        }
+      }
+    }
+    if constexpr (std::is_invocable_r_v<std::optional<::Selectivity>, Handler &,
+                                        selectivity_request &>) {
+      if (IsA(node, SupportRequestSelectivity)) {
+        selectivity_request request(reinterpret_cast<::SupportRequestSelectivity *>(node));
+        std::optional<::Selectivity> selectivity = handler(request);
+        if (selectivity.has_value()) {
+          request->selectivity = *selectivity;
+          return node;
+        }
+      }
+    }
+    if constexpr (std::is_invocable_r_v<std::optional<cost_estimate>, Handler &, cost_request &>) {
+      if (IsA(node, SupportRequestCost)) {
+        cost_request request(reinterpret_cast<::SupportRequestCost *>(node));
+        std::optional<cost_estimate> cost = handler(request);
+        if (cost.has_value()) {
+          request->startup = cost->startup;
+          request->per_tuple = cost->per_tuple;
+          return node;
+        }
+      }
+    }
+    if constexpr (std::is_invocable_r_v<::Node *, Handler &, simplify_request &>) {
+      if (IsA(node, SupportRequestSimplify)) {
+        simplify_request request(reinterpret_cast<::SupportRequestSimplify *>(node));
+        return handler(request);
+      }
+    }
+    return nullptr;
+  }
+};
+
+} // namespace cppgres
@@ -0,0 +1,423 @@
+#pragma once
+
+#include "executor.h"
+#include "guard.h"
+#include "memory.h"
+#include "types.h"
+
+#include <array>
+#include <format>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+extern "C" {
+#include <access/heapam.h>
+#include <access/table.h>
+#include <access/tableam.h>
+#include <access/xact.h>
+#include <catalog/namespace.h>
+#include <executor/execPartition.h>
+#include <executor/executor.h>
+#include <miscadmin.h>
+#include <nodes/makefuncs.h>
+#include <parser/parse_relation.h>
+#include <tcop/utility.h>
+#include <utils/acl.h>
+#include <utils/regproc.h>
+#include <utils/rel.h>
+#include <utils/rls.h>
+#include <utils/snapmgr.h>
+}
+
+namespace cppgres {
+
+/**
+ * Relation kept open (and locked) for the lifetime of the object
+ */
+struct relation {
+  relation(::Oid oid, ::LOCKMODE lockmode)
+      : rel(ffi_guarded(::table_open)(oid, lockmode)), lockmode(lockmode) {}
+
+  /**
+   * Opens a relation by its (optionally schema-qualified) name
+   */
+  relation(std::string_view name, ::LOCKMODE lockmode)
+      : rel(ffi_guarded([](const char *name, ::LOCKMODE lockmode) {
+          return ::table_openrv(
+              ::makeRangeVarFromNameList(::stringToQualifiedNameList(name, nullptr)), lockmode);
+        })(std::string(name).c_str(), lockmode)),
+        lockmode(lockmode) {}
+
+  relation(const relation &) = delete;
+  relation(relation &&other) noexcept
+      : rel(std::exchange(other.rel, nullptr)), lockmode(other.lockmode) {}
+
+  /**
+   * Closes the relation, ignoring errors, as it may be destroyed while an error unwinds
+   */
+  ~relation() {
+    if (rel != nullptr) {
+      try {
+        ffi_guarded(::table_close)(rel, lockmode);
+      } catch (...) {
+      }
+    }
+  }
+
+  operator ::Relation() const { return rel; }
+
+  ::Oid oid() const { return RelationGetRelid(rel); }
+  ::TupleDesc tuple_descriptor() const { return RelationGetDescr(rel); }
+
+private:
+  ::Relation rel;
+  ::LOCKMODE lockmode;
+};
+
+enum class row_access { read, write };
+
+/**
+ * Attributes of a table the elements of `Row` are stored in, in order
+ */
+template <typename Row> using row_columns = std::array<int, std::tuple_size_v<Row>>;
+
+/**
+ * Checks that the columns described by `tupdesc` match the elements of `Row`, returning the
+ * attribute every element maps to
+ *
+ * Dropped columns are skipped, so elements correspond to the live columns in order. Columns
+ * that are read must have a type convertible into the element; columns that are written must
+ * have exactly the element's type if it is known, or otherwise one convertible into it.
+ */
+template <typename Row> row_columns<Row> check_row_type(::TupleDesc tupdesc, row_access access) {
+  row_columns<Row> columns;
+  std::size_t live = 0;
+  for (int i = 0; i < tupdesc->natts; i++) {
+    if (!TupleDescAttr(tupdesc, i)->attisdropped) {
+      if (live < columns.size()) {
+        columns[live] = i;
+      }
+      live++;
+    }
+  }
+  if (live != columns.size()) {
+    throw std::runtime_error(
+        std::format("expected {} columns, table has {}", columns.size(), live));
+  }
+  [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+    (([&] {
+       using elem = utils::remove_optional_t<std::tuple_element_t<Is, Row>>;
+       auto attr = TupleDescAttr(tupdesc, columns[Is]);
+       constexpr ::Oid oid = type_for<elem>().oid;
+       auto typ = type{.oid = attr->atttypid};
+       bool compatible = access == row_access::write && oid != InvalidOid
+                             ? oid == attr->atttypid
+                             : oid == attr->atttypid || typ.template is<elem>();
+       if (!compatible) {
+         throw std::runtime_error(
+             std::format("column {} has an incompatible type", NameStr(attr->attname)));
+       }
+     }()),
+     ...);
+  }(std::make_index_sequence<std::tuple_size_v<Row>>{});
+  return columns;
+}
+
+/**
+ * Loads rows directly into a table, bypassing SQL
+ *
+ * Rows are converted into tuples with the relation's tuple descriptor and written in batches
+ * of `batch_size` through `table_multi_insert` with a `BulkInsertState`, after which the
+ * table's indexes are updated, similarly to how `COPY FROM` does it. `NOT NULL` and `CHECK`
+ * constraints are enforced, and so are the bounds of a partition loaded directly. Tables with
+ * row-level insert triggers (including foreign keys), row-level security or stored generated
+ * columns are not supported. Loading into permanent tables is rejected in read-only
+ * transactions.
+ *
+ * `finish()` must be called to write out the last batch; destroying the loader without it
+ * discards rows not yet written.
+ */
+template <query_argument_tuple Row> struct bulk_insert {
+  explicit bulk_insert(relation &&rel, std::size_t batch_size = 1000)
+      : rel(std::move(rel)), batch_size(std::max<std::size_t>(batch_size, 1)) {
+    init();
+  }
+  explicit bulk_insert(std::string_view name, std::size_t batch_size = 1000)
+      : bulk_insert(relation(name, RowExclusiveLock), batch_size) {}
+  explicit bulk_insert(::Oid oid, std::size_t batch_size = 1000)
+      : bulk_insert(relation(oid, RowExclusiveLock), batch_size) {}
+
+  bulk_insert(const bulk_insert &) = delete;
+
+  /**
+   * Releases the loader, ignoring errors, as it may be destroyed while an error unwinds
+   */
+  ~bulk_insert() {
+    try {
+      release();
+    } catch (...) {
+    }
+  }
+
+  /**
+   * Adds a row, writing out the current batch once it is full
+   */
+  void insert(Row row) {
+    auto slot = slots[nslots];
+    ffi_guarded(::ExecClearTuple)(slot);
+    {
+      memory_context_scope scope(batch_ctx);
+      encode_datums(row, slot->tts_values, slot->tts_isnull, slot->tts_tupleDescriptor->natts,
+                    columns);
+    }
+    ffi_guarded(::ExecStoreVirtualTuple)(slot);
+    if (check_constraints || check_partition) {
+      ffi_guarded([](bulk_insert *self, ::TupleTableSlot *slot) {
+        if (self->check_constraints) {
+          ::ExecConstraints(self->result_rel, slot, self->estate);
+        }
+        if (self->check_partition) {
+          ::ExecPartitionCheck(self->result_rel, slot, self->estate, true);
+        }
+        // the checks are evaluated in the per-tuple context
+        ResetPerTupleExprContext(self->estate);
+      })(this, slot);
+    }
+    if (++nslots == batch_size) {
+      flush();
+    }
+  }
+
+  /**
+   * Writes out the current batch
+   */
+  void flush() {
+    if (nslots == 0) {
+      return;
+    }
+    ffi_guarded([](bulk_insert *self) {
+      ::table_multi_insert(self->rel, self->slots.data(), static_cast<int>(self->nslots),
+                           self->cid, 0, self->bistate);
+      if (self->result_rel->ri_NumIndices > 0) {
+        for (std::size_t i = 0; i < self->nslots; i++) {
+          ::List *recheck = ::ExecInsertIndexTuples(self->result_rel, self->slots[i],
+                                                    self->estate, false, false, nullptr, NIL,
+                                                    false);
+          ::list_free(recheck);
+          ResetPerTupleExprContext(self->estate);
+        }
+      }
+      ::MemoryContextReset(self->batch_ctx);
+    })(this);
+    inserted += nslots;
+    nslots = 0;
+  }
+
+  /**
+   * Writes out the last batch and releases the resources used by the loader
+   *
+   * Returns the total number of rows inserted.
+   */
+  uint64_t finish() {
+    flush();
+    ffi_guarded(::table_finish_bulk_insert)(rel, 0);
+    release();
+    return inserted;
+  }
+
+  uint64_t processed() const { return inserted + nslots; }
+
+private:
+  void init() {
+    ::Relation r = rel;
+    auto tupdesc = rel.tuple_descriptor();
+    if (r->rd_rel->relkind != RELKIND_RELATION) {
+      throw std::runtime_error("bulk insert is only supported for plain tables");
+    }
+    columns = check_row_type<Row>(tupdesc, row_access::write);
+    if (r->trigdesc != nullptr &&
+        (r->trigdesc->trig_insert_before_row || r->trigdesc->trig_insert_after_row ||
+         r->trigdesc->trig_insert_instead_row)) {
+      throw std::runtime_error("bulk insert into tables with row insert triggers is not supported");
+    }
+    if (tupdesc->constr != nullptr && tupdesc->constr->has_generated_stored) {
+      throw std::runtime_error("bulk insert into tables with generated columns is not supported");
+    }
+    if (ffi_guarded(::check_enable_rls)(rel.oid(), InvalidOid, false) == RLS_ENABLED) {
+      throw std::runtime_error("bulk insert into tables with row-level security is not supported");
+    }
+    if (!r->rd_islocaltemp) {
+      ffi_guarded(::PreventCommandIfReadOnly)("bulk insert");
+    }
+    check_constraints = tupdesc->constr != nullptr;
+    check_partition = r->rd_rel->relispartition;
+
+    ffi_guarded([](bulk_insert *self) {
+      ::Relation r = self->rel;
+      auto rte = makeNode(RangeTblEntry);
+      rte->rtekind = ::RTE_RELATION;
+      rte->relid = RelationGetRelid(r);
+      rte->relkind = r->rd_rel->relkind;
+      rte->rellockmode = RowExclusiveLock;
+      ::List *perminfos = NIL;
+      auto perminfo = ::addRTEPermissionInfo(&perminfos, rte);
+      perminfo->requiredPerms = ACL_INSERT;
+      ::List *rtable = list_make1(rte);
+      ::ExecCheckPermissions(rtable, perminfos, true);
+
+      self->estate = ::CreateExecutorState();
+      ::ExecInitRangeTable(self->estate, rtable, perminfos);
+      self->result_rel = makeNode(ResultRelInfo);
+      ::ExecInitResultRelation(self->estate, self->result_rel, 1);
+      ::ExecOpenIndices(self->result_rel, false);
+
+      self->bistate = ::GetBulkInsertState();
+      self->cid = ::GetCurrentCommandId(true);
+      self->batch_ctx = ::AllocSetContextCreate(::CurrentMemoryContext, "cppgres bulk insert",
+                                                ALLOCSET_DEFAULT_SIZES);
+    })(this);
+
+    slots.reserve(batch_size);
+    for (std::size_t i = 0; i < batch_size; i++) {
+      slots.push_back(ffi_guarded(::table_slot_create)(rel, nullptr));
+    }
+  }
+
+  void release() {
+    for (auto slot : slots) {
+      ffi_guarded(::ExecDropSingleTupleTableSlot)(slot);
+    }
+    slots.clear();
+    nslots = 0;
+    if (bistate != nullptr) {
+      ffi_guarded(::FreeBulkInsertState)(bistate);
+      bistate = nullptr;
+    }
+    if (estate != nullptr) {
+      ffi_guarded([](::EState *estate) {
+        ::ExecCloseResultRelations(estate);
+        ::ExecCloseRangeTableRelations(estate);
+        ::FreeExecutorState(estate);
+      })(estate);
+      estate = nullptr;
+    }
+    if (batch_ctx != nullptr) {
+      ffi_guarded(::MemoryContextDelete)(batch_ctx);
+      batch_ctx = nullptr;
+    }
+  }
+
+  relation rel;
+  row_columns<Row> columns;
+  std::size_t batch_size;
+  bool check_constraints = false;
+  bool check_partition = false;
+  ::EState *estate = nullptr;
+  ::ResultRelInfo *result_rel = nullptr;
+  ::BulkInsertState bistate = nullptr;
+  ::CommandId cid = 0;
+  ::MemoryContext batch_ctx = nullptr;
+  std::vector<::TupleTableSlot *> slots;
+  std::size_t nslots = 0;
+  uint64_t inserted = 0;
+};
+
+/**
+ * Sequential scan over a table, bypassing SQL
+ *
+ * Rows are read through a single reused slot under the active snapshot and decoded into
+ * `Row`, whose elements the table's columns must be convertible into (see `check_row_type`).
+ * Values referencing tuple data are only valid until the scan advances. Tables with row-level
+ * security enabled are not supported.
+ */
+template <datumable_tuple Row> struct table_scan {
+  explicit table_scan(relation &&rel) : rel(std::move(rel)) { init(); }
+  explicit table_scan(std::string_view name) : table_scan(relation(name, AccessShareLock)) {}
+  explicit table_scan(::Oid oid) : table_scan(relation(oid, AccessShareLock)) {}
+
+  table_scan(const table_scan &) = delete;
+
+  /**
+   * Ends the scan, ignoring errors, as it may be destroyed while an error unwinds
+   */
+  ~table_scan() {
+    try {
+      if (scan != nullptr) {
+        ffi_guarded(::table_endscan)(scan);
+      }
+      if (slot != nullptr) {
+        ffi_guarded(::ExecDropSingleTupleTableSlot)(slot);
+      }
+      if (snapshot != nullptr) {
+        ffi_guarded(::UnregisterSnapshot)(snapshot);
+      }
+    } catch (...) {
+    }
+  }
+
+  struct iterator {
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Row;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    explicit iterator(table_scan *scan) : scan(scan) { ++*this; }
+
+    Row &operator*() const {
+      if (!row.has_value()) {
+        row.emplace(decode_datums<Row>(scan->slot->tts_values, scan->slot->tts_isnull,
+                                       scan->columns));
+      }
+      return *row;
+    }
+
+    iterator &operator++() {
+      row.reset();
+      done = !ffi_guarded([](::TableScanDesc scan, ::TupleTableSlot *slot) {
+        if (!::table_scan_getnextslot(scan, ::ForwardScanDirection, slot)) {
+          return false;
+        }
+        ::slot_getallattrs(slot);
+        return true;
+      })(scan->scan, scan->slot);
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    bool operator==(std::default_sentinel_t) const { return done; }
+
+  private:
+    table_scan *scan = nullptr;
+    bool done = true;
+    mutable std::optional<Row> row;
+  };
+
+  iterator begin() { return iterator(this); }
+  std::default_sentinel_t end() const { return {}; }
+
+private:
+  void init() {
+    columns = check_row_type<Row>(rel.tuple_descriptor(), row_access::read);
+    if (ffi_guarded(::pg_class_aclcheck)(rel.oid(), ::GetUserId(), ACL_SELECT) != ::ACLCHECK_OK) {
+      throw std::runtime_error("permission denied");
+    }
+    if (ffi_guarded(::check_enable_rls)(rel.oid(), InvalidOid, false) == RLS_ENABLED) {
+      throw std::runtime_error("scanning tables with row-level security is not supported");
+    }
+    snapshot = ffi_guarded(::RegisterSnapshot)(ffi_guarded(::GetActiveSnapshot)());
+    slot = ffi_guarded(::table_slot_create)(rel, nullptr);
+    scan = ffi_guarded(::table_beginscan)(rel, snapshot, 0, nullptr);
+  }
+
+  relation rel;
+  row_columns<Row> columns;
+  ::Snapshot snapshot = nullptr;
+  ::TupleTableSlot *slot = nullptr;
+  ::TableScanDesc scan = nullptr;
+};
+
+} // namespace cppgres
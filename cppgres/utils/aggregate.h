@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace cppgres::utils {
+
+namespace detail {
+struct any_field {
+  template <typename T> operator T() const;
+};
+
+template <typename T, typename... Fields> constexpr std::size_t aggregate_size() {
+  if constexpr (requires { T{Fields{}..., any_field{}}; }) {
+    return aggregate_size<T, Fields..., any_field>();
+  } else {
+    return sizeof...(Fields);
+  }
+}
+} // namespace detail
+
+/**
+ * Number of fields of the aggregate `T`
+ */
+template <typename T>
+  requires std::is_aggregate_v<T>
+inline constexpr std::size_t aggregate_size = detail::aggregate_size<T>();
+
+/**
+ * Maximum number of fields supported by `tie_fields`
+ */
+inline constexpr std::size_t max_aggregate_size = 16;
+
+/**
+ * Returns a tuple of references to the fields of the aggregate `value`
+ */
+template <typename T>
+  requires std::is_aggregate_v<T> && (aggregate_size<T> > 0) &&
+           (aggregate_size<T> <= max_aggregate_size)
+auto tie_fields(T &value) {
+  constexpr std::size_t n = aggregate_size<T>;
+  if constexpr (n == 1) {
+    auto &[f0] = value;
+    return std::tie(f0);
+  } else if constexpr (n == 2) {
+    auto &[f0, f1] = value;
+    return std::tie(f0, f1);
+  } else if constexpr (n == 3) {
+    auto &[f0, f1, f2] = value;
+    return std::tie(f0, f1, f2);
+  } else if constexpr (n == 4) {
+    auto &[f0, f1, f2, f3] = value;
+    return std::tie(f0, f1, f2, f3);
+  } else if constexpr (n == 5) {
+    auto &[f0, f1, f2, f3, f4] = value;
+    return std::tie(f0, f1, f2, f3, f4);
+  } else if constexpr (n == 6) {
+    auto &[f0, f1, f2, f3, f4, f5] = value;
+    return std::tie(f0, f1, f2, f3, f4, f5);
+  } else if constexpr (n == 7) {
+    auto &[f0, f1, f2, f3, f4, f5, f6] = value;
+    return std::tie(f0, f1, f2, f3, f4, f5, f6);
+  } else if constexpr (n == 8) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7] = value;
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7);
+  } else if constexpr (n == 9) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8] = value;
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8);
+  } else if constexpr (n == 10) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9] = value;
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9);
+  } else if constexpr (n == 11) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10] = value;
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10);
+  } else if constexpr (n == 12) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11] = value;
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11);
+  } else if constexpr (n == 13) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12] = value;
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12);
+  } else if constexpr (n == 14) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13] = value;
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13);
+  } else if constexpr (n == 15) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14] = value;
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14);
+  } else if constexpr (n == 16) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15] = value;
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15);
+  }
+}
+
+} // namespace cppgres::utils
@@ -33,6 +33,25 @@ struct function_traits<R (C:: *)(Args...) const> {
   static constexpr std::size_t arity = sizeof...(Args);
 };
 
+// Specialization for non-const member function pointers.
+template <typename C, typename R, typename... Args> struct function_traits<R (C:: *)(Args...)> {
+  using argument_types = std::tuple<Args...>;
+  static constexpr std::size_t arity = sizeof...(Args);
+};
+
+// Specializations for noexcept functions delegate to the ones above.
+template <typename R, typename... Args>
+struct function_traits<R (*)(Args...) noexcept> : function_traits<R (*)(Args...)> {};
+template <typename R, typename... Args>
+struct function_traits<R (&)(Args...) noexcept> : function_traits<R (&)(Args...)> {};
+template <typename R, typename... Args>
+struct function_traits<R(Args...) noexcept> : function_traits<R(Args...)> {};
+template <typename C, typename R, typename... Args>
+struct function_traits<R (C:: *)(Args...) const noexcept>
+    : function_traits<R (C:: *)(Args...) const> {};
+template <typename C, typename R, typename... Args>
+struct function_traits<R (C:: *)(Args...) noexcept> : function_traits<R (C:: *)(Args...)> {};
+
 // Fallback for functors/lambdas that are not plain function pointers.
 // This will delegate to the member function pointer version.
 template <typename T> struct function_traits : function_traits<decltype(&T::operator())> {};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+
+namespace cppgres::utils {
+
+/**
+ * Lazily evaluated coroutine range yielding references to `T`
+ *
+ * A minimal stand-in for C++23 `std::generator`: it is a move-only input view, so it can be
+ * composed with `std::ranges` adaptors. The coroutine runs only as far as the range is
+ * consumed and is destroyed together with the generator.
+ */
+template <typename T> class generator : public std::ranges::view_interface<generator<T>> {
+public:
+  struct promise_type {
+    T *value = nullptr;
+    std::exception_ptr exception;
+
+    generator get_return_object() noexcept {
+      return generator(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    std::suspend_always final_suspend() const noexcept { return {}; }
+
+    std::suspend_always yield_value(T &v) noexcept {
+      value = std::addressof(v);
+      return {};
+    }
+    std::suspend_always yield_value(T &&v) noexcept {
+      value = std::addressof(v);
+      return {};
+    }
+
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+    template <typename U> std::suspend_never await_transform(U &&) = delete;
+  };
+
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  struct iterator {
+    using iterator_category = std::input_iterator_tag;
+    using value_type = std::remove_cvref_t<T>;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    explicit iterator(handle_type handle) : handle(handle) {}
+
+    T &operator*() const { return *handle.promise().value; }
+
+    iterator &operator++() {
+      resume(handle);
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    bool operator==(std::default_sentinel_t) const { return !handle || handle.done(); }
+
+  private:
+    handle_type handle;
+  };
+
+  generator() = default;
+  generator(const generator &) = delete;
+  generator(generator &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+  generator &operator=(generator &&other) noexcept {
+    if (this != &other) {
+      if (handle) {
+        handle.destroy();
+      }
+      handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+  }
+  ~generator() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  /**
+   * Starts the coroutine; can only be called once
+   */
+  iterator begin() {
+    if (handle) {
+      resume(handle);
+    }
+    return iterator(handle);
+  }
+  std::default_sentinel_t end() const noexcept { return {}; }
+
+private:
+  explicit generator(handle_type handle) : handle(handle) {}
+
+  static void resume(handle_type handle) {
+    handle.resume();
+    if (handle.promise().exception) {
+      std::rethrow_exception(std::exchange(handle.promise().exception, nullptr));
+    }
+  }
+
+  handle_type handle;
+};
+
+} // namespace cppgres::utils
@@ -0,0 +1,205 @@
+#pragma once
+
+#include "datum.h"
+#include "error.h"
+#include "function.h"
+#include "guard.h"
+#include "utils/function_traits.h"
+
+#include <cstddef>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include <utils/memutils.h>
+#include <windowapi.h>
+}
+
+namespace cppgres {
+
+enum class window_seek {
+  current = WINDOW_SEEK_CURRENT,
+  head = WINDOW_SEEK_HEAD,
+  tail = WINDOW_SEEK_TAIL,
+};
+
+/**
+ * Typed access to the window a window function is evaluated in
+ *
+ * Rows are addressed by their position in the partition; argument values of other rows are
+ * read through the partition or the frame of the current row.
+ */
+struct window_object {
+  explicit window_object(::WindowObject obj) : obj(obj) {}
+
+  /**
+   * Position of the current row in the partition
+   */
+  int64_t current_position() const { return ffi_guarded(::WinGetCurrentPosition)(obj); }
+
+  /**
+   * Number of rows in the partition; reads the entire partition
+   */
+  int64_t partition_row_count() const { return ffi_guarded(::WinGetPartitionRowCount)(obj); }
+
+  /**
+   * Tells the window that rows before `position` will no longer be fetched
+   */
+  void set_mark_position(int64_t position) { ffi_guarded(::WinSetMarkPosition)(obj, position); }
+
+  bool rows_are_peers(int64_t position1, int64_t position2) const {
+    return ffi_guarded(::WinRowsArePeers)(obj, position1, position2);
+  }
+
+  /**
+   * Value of argument `argno` for the current row
+   */
+  template <typename T>
+    requires convertible_from_nullable_datum<T>
+  std::optional<T> argument(int argno) const {
+    bool isnull;
+    auto value = ffi_guarded(::WinGetFuncArgCurrent)(obj, argno, &isnull);
+    return convert<T>(value, isnull);
+  }
+
+  /**
+   * Value of argument `argno` for the row `offset` rows away from `seek` in the partition,
+   * or `std::nullopt` if the value is null or there is no such row (check with `isout`)
+   */
+  template <typename T>
+    requires convertible_from_nullable_datum<T>
+  std::optional<T> argument_in_partition(int argno, int offset,
+                                         window_seek seek = window_seek::current,
+                                         bool set_mark = false, bool *isout = nullptr) const {
+    bool isnull;
+    auto value = ffi_guarded(::WinGetFuncArgInPartition)(obj, argno, offset,
+                                                         static_cast<int>(seek), set_mark, &isnull,
+                                                         isout);
+    return convert<T>(value, isnull);
+  }
+
+  /**
+   * Value of argument `argno` for the row `offset` rows away from `seek` in the frame of the
+   * current row, or `std::nullopt` if the value is null or there is no such row (check with
+   * `isout`)
+   */
+  template <typename T>
+    requires convertible_from_nullable_datum<T>
+  std::optional<T> argument_in_frame(int argno, int offset, window_seek seek = window_seek::head,
+                                     bool set_mark = false, bool *isout = nullptr) const {
+    bool isnull;
+    auto value = ffi_guarded(::WinGetFuncArgInFrame)(obj, argno, offset, static_cast<int>(seek),
+                                                     set_mark, &isnull, isout);
+    return convert<T>(value, isnull);
+  }
+
+  /**
+   * State kept for the duration of the current partition
+   *
+   * Constructed on first access in the partition's memory and destroyed when the window
+   * moves on to the next partition. A window function must always use the same `State`.
+   */
+  template <std::default_initializable State> State &partition_state() {
+    static_assert(alignof(partition_holder<State>) <= MAXIMUM_ALIGNOF,
+                  "partition states can't be more strictly aligned than palloc'd memory");
+    auto h = static_cast<partition_holder<State> *>(
+        ffi_guarded(::WinGetPartitionLocalMemory)(obj, sizeof(partition_holder<State>)));
+    if (!h->initialized) {
+      new (&h->state) State();
+      h->initialized = true;
+      h->callback.func = [](void *arg) {
+        std::launder(reinterpret_cast<State *>(&static_cast<partition_holder<State> *>(arg)->state))
+            ->~State();
+      };
+      h->callback.arg = h;
+      ffi_guarded(::MemoryContextRegisterResetCallback)(ffi_guarded(::GetMemoryChunkContext)(h),
+                                                       &h->callback);
+    }
+    return *std::launder(reinterpret_cast<State *>(&h->state));
+  }
+
+  operator ::WindowObject() const { return obj; }
+
+private:
+  // partition-local memory is zeroed when allocated, so `initialized` starts out false
+  template <typename State> struct partition_holder {
+    bool initialized;
+    ::MemoryContextCallback callback;
+    alignas(State) std::byte state[sizeof(State)];
+  };
+
+  template <typename T> static std::optional<T> convert(::Datum value, bool isnull) {
+    auto nd = isnull ? nullable_datum() : nullable_datum(value);
+    return from_nullable_datum<T>(nd);
+  }
+
+  ::WindowObject obj;
+};
+
+template <typename Tuple> struct window_function_arguments;
+template <typename W, typename... Args>
+struct window_function_arguments<std::tuple<W, Args...>> {
+  using types = std::tuple<Args...>;
+  using signature = void (*)(Args...);
+};
+
+/**
+ * Window function taking the window as its first parameter, followed by the arguments of
+ * the current row
+ */
+template <typename Func>
+concept window_function_type =
+    requires {
+      typename window_function_arguments<
+          typename utils::function_traits::function_traits<Func>::argument_types>::signature;
+    } &&
+    std::same_as<std::tuple_element_t<
+                     0, typename utils::function_traits::function_traits<Func>::argument_types>,
+                 window_object &> &&
+    datumable_arguments<typename window_function_arguments<
+        typename utils::function_traits::function_traits<Func>::argument_types>::signature>;
+
+template <window_function_type Func> struct postgres_window_function {
+  Func func;
+
+  explicit postgres_window_function(Func f) : func(f) {}
+
+  using arguments = window_function_arguments<
+      typename utils::function_traits::function_traits<Func>::argument_types>;
+
+  auto operator()(FunctionCallInfo fc) -> ::Datum {
+    return exception_guarded([&] {
+      if (fc->context == nullptr || !IsA(fc->context, WindowObjectData)) {
+        throw std::runtime_error("window function called outside of a window");
+      }
+      window_object window(reinterpret_cast<::WindowObject>(fc->context));
+
+      auto &site = call_site::of(fc);
+      if (!site.arguments_checked) {
+        check_argument_types<typename arguments::signature>(fc);
+        site.arguments_checked = true;
+      }
+
+      auto result = [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+        return func(window, argument<std::tuple_element_t<Is, typename arguments::types>>(
+                                window, static_cast<int>(Is))...);
+      }(std::make_index_sequence<std::tuple_size_v<typename arguments::types>>{});
+
+      return result_datum(fc, result);
+    });
+  }
+
+private:
+  template <typename T> static T argument(window_object &window, int argno) {
+    bool isnull;
+    auto value = ffi_guarded(::WinGetFuncArgCurrent)(window, argno, &isnull);
+    auto nd = isnull ? nullable_datum() : nullable_datum(value);
+    return decode_datum<std::remove_cvref_t<T>>(nd);
+  }
+};
+
+} // namespace cppgres
@@ -12,6 +12,11 @@ if [ -z "${BUILD_DIR}" ]; then
   exit 1
 fi
 
+if [ ! -f "${BUILD_DIR}/cppgres_tests.sql" ]; then
+  echo "${BUILD_DIR}/cppgres_tests.sql is missing (was objcopy found when configuring?)"
+  exit 1
+fi
+
 _pg_bindir=$(${PG_CONFIG} --bindir)
 
 rm -rf .testdb
@@ -24,6 +29,7 @@ cleanup() {
 
 trap cleanup ERR
 
-${_pg_bindir}/psql -v ON_ERROR_STOP=1 -h $(realpath .testdb) -d postgres -c "load '${BUILD_DIR}/libcppgres_tests.so'; do \$\$ begin if not cppgres_tests() then raise exception 'tests failed'; end if; end; \$\$;"
+sed "s|MODULE_PATHNAME|${BUILD_DIR}/libcppgres_tests.so|g" "${BUILD_DIR}/cppgres_tests.sql" | ${_pg_bindir}/psql -v ON_ERROR_STOP=1 -h $(realpath .testdb) -d postgres
+${_pg_bindir}/psql -v ON_ERROR_STOP=1 -h $(realpath .testdb) -d postgres -c "do \$\$ begin if not cppgres_tests() then raise exception 'tests failed'; end if; end; \$\$;"
 ${_pg_bindir}/pg_ctl -D .testdb stop
 rm -rf .testdb
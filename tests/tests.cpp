@@ -10,17 +10,31 @@ extern "C" {
 PG_MODULE_MAGIC;
 PG_FUNCTION_INFO_V1(cppgres_tests);
 PG_FUNCTION_INFO_V1(raise_exception);
+PG_FUNCTION_INFO_V1(srf_series);
+PG_FUNCTION_INFO_V1(srf_vector);
+PG_FUNCTION_INFO_V1(srf_series_support);
+PG_FUNCTION_INFO_V1(is_even);
+PG_FUNCTION_INFO_V1(is_even_support);
+PG_FUNCTION_INFO_V1(add_one);
+PG_FUNCTION_INFO_V1(add_strict);
+PG_FUNCTION_INFO_V1(int_mean_transfn);
+PG_FUNCTION_INFO_V1(int_mean_finalfn);
+PG_FUNCTION_INFO_V1(int_mean_combinefn);
+PG_FUNCTION_INFO_V1(int_mean_serialfn);
+PG_FUNCTION_INFO_V1(int_mean_deserialfn);
+PG_FUNCTION_INFO_V1(divmod);
+PG_FUNCTION_INFO_V1(min_max);
+PG_FUNCTION_INFO_V1(pair_sum);
+PG_FUNCTION_INFO_V1(pair_diff);
+PG_FUNCTION_INFO_V1(window_row_number);
+PG_FUNCTION_INFO_V1(window_frame_sum);
 
 #include <executor/spi.h>
 
-#include <dlfcn.h>
-
 #include <utils/acl.h>
 #include <utils/date.h>
 }
 
-static const char *get_library_name();
-
 #define _assert(expr)                                                                              \
   ({                                                                                               \
     auto value = (expr);                                                                           \
@@ -67,14 +81,11 @@ static std::optional<bool> raise_exception_impl() {
 }
 
 postgres_function(raise_exception, raise_exception_impl);
+postgres_function_sql(raise_exception, "() returns bool");
 
 static bool exception_to_error() {
   bool result = false;
   cppgres::ffi_guarded(::SPI_connect)();
-  auto stmt =
-      std::format("create or replace function raise_exception() returns bool language 'c' as '{}'",
-                  get_library_name());
-  cppgres::ffi_guarded(::SPI_execute)(stmt.c_str(), false, 0);
   cppgres::ffi_guarded(::BeginInternalSubTransaction)(nullptr);
   try {
     cppgres::ffi_guarded(::SPI_execute)("select raise_exception()", false, 0);
@@ -141,90 +152,861 @@ bool spi() {
     i++;
     result = result && _assert(std::get<0>(re) == i + 1);
   }
-  result = result && _assert(std::get<0>(res.begin()[0]) == 2);
+  result = result && _assert(std::get<0>(res.random_access()[0]) == 2);
+  static_assert(std::input_iterator<decltype(res.begin())>);
+  result = result && _assert(std::ranges::distance(res) == 100);
+
+  auto ra = res.random_access();
+  static_assert(std::random_access_iterator<decltype(ra.begin())>);
+  result = result && _assert(std::get<0>(*(ra.end() - 1)) == 101);
+  result = result && _assert(std::get<0>(ra.begin()[49]) == 51);
   return result;
 }
 
-static bool varlena_text() {
+bool spi_arguments() {
   bool result = true;
-  auto nd = cppgres::nullable_datum(::PointerGetDatum(::cstring_to_text("test")));
-  auto s = cppgres::from_nullable_datum<cppgres::text>(nd);
-  std::string_view str = *s;
-  result = result && _assert(str == "test");
+  cppgres::spi_executor spi;
+  std::optional<int64_t> null;
+  auto res = spi.query<std::tuple<std::optional<int64_t>, std::optional<bool>>>(
+      "select $1 + $2 + $3 + $4, $5 is null", int64_t(1), int32_t(2), int16_t(3), int64_t(4),
+      null);
+  auto row = *res.begin();
+  result = result && _assert(std::get<0>(row) == 10);
+  result = result && _assert(std::get<1>(row) == true);
+  return result;
+}
+
+bool spi_options() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  auto res = spi.query<std::tuple<std::optional<int64_t>>>(
+      {.read_only = true, .row_limit = 10}, "select i from generate_series(1,$1) i",
+      int64_t(100));
+  result = result && _assert(res.size() == 10);
+
+  auto res1 = spi.query<std::tuple<std::optional<int64_t>>>(
+      {.parallel_ok = false}, "select count(*) from generate_series(1,$1) i", int64_t(100));
+  result = result && _assert(std::get<0>(*res1.begin()) == 100);
+  return result;
+}
+
+bool spi_for_each() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  int64_t sum = 0;
+  auto n = spi.for_each<std::tuple<std::optional<int64_t>>>(
+      "select i from generate_series(1,$1) i",
+      [&](std::tuple<std::optional<int64_t>> &row) { sum += std::get<0>(row).value(); },
+      int64_t(100));
+  result = result && _assert(n == 100);
+  result = result && _assert(sum == 5050);
+
+  // stopping early
+  n = spi.for_each<std::tuple<std::optional<int64_t>>>(
+      "select i from generate_series(1,$1) i",
+      [&](std::tuple<std::optional<int64_t>> &row) { return std::get<0>(row) < 10; },
+      int64_t(100));
+  result = result && _assert(n == 10);
+
+  // exceptions are propagated
+  try {
+    spi.for_each<std::tuple<std::optional<int64_t>>>(
+        "select i from generate_series(1,$1) i",
+        [&](std::tuple<std::optional<int64_t>> &) { throw std::runtime_error("stop"); },
+        int64_t(100));
+    result = result && _assert(false);
+  } catch (std::runtime_error &e) {
+    result = result && _assert(std::string_view(e.what()) == "stop");
+  }
+  return result;
+}
+
+bool spi_execute_many() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  cppgres::ffi_guarded(::SPI_execute)("create temporary table execute_many (a int8, b int4)",
+                                      false, 0);
+
+  std::vector<std::tuple<int64_t, std::optional<int32_t>>> rows;
+  for (int64_t i = 0; i < 2500; i++) {
+    rows.emplace_back(i, i % 2 == 0 ? std::nullopt : std::optional<int32_t>(i));
+  }
+  result = result && _assert(spi.insert_many("execute_many", rows, 1000) == 2500);
+  result = result && _assert(spi.execute_many("insert into execute_many values ($1, $2)",
+                                              rows | std::views::take(10)) == 10);
+
+  auto res = spi.query<std::tuple<std::optional<int64_t>, std::optional<int64_t>>>(
+      "select count(*), count(b) from execute_many where a >= $1", int64_t(0));
+  auto row = *res.begin();
+  result = result && _assert(std::get<0>(row) == 2510);
+  result = result && _assert(std::get<1>(row) == 1255);
+
+  // the table name is quoted in the generated statement
+  cppgres::ffi_guarded(::SPI_execute)("create temporary table \"execute many\" (a int8, b int4)",
+                                      false, 0);
+  result = result && _assert(spi.insert_many("\"execute many\"", rows, 1000) == 2500);
+  return result;
+}
+
+bool bulk_insert() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  cppgres::ffi_guarded(::SPI_execute)(
+      "create temporary table bulk_insert (a int8 primary key, b int4 not null)", false, 0);
+
+  cppgres::bulk_insert<std::tuple<int64_t, int32_t>> loader("bulk_insert", 100);
+  for (int64_t i = 0; i < 1050; i++) {
+    loader.insert({i, static_cast<int32_t>(i * 2)});
+  }
+  result = result && _assert(loader.finish() == 1050);
+
+  auto res = spi.query<std::tuple<std::optional<int64_t>>>(
+      "select b from bulk_insert where a = $1", int64_t(1049));
+  result = result && _assert(res.size() == 1);
+  result = result && _assert(std::get<0>(*res.begin()) == 2098);
+
+  // rows outside of the bounds of a partition are rejected
+  cppgres::ffi_guarded(::SPI_execute)(
+      "create temporary table bulk_insert_parted (a int8, b int4) partition by range (a); "
+      "create temporary table bulk_insert_part partition of bulk_insert_parted "
+      "for values from (0) to (10)",
+      false, 0);
+  cppgres::ffi_guarded(::BeginInternalSubTransaction)(nullptr);
+  try {
+    cppgres::bulk_insert<std::tuple<int64_t, int32_t>> part("bulk_insert_part");
+    part.insert({5, 0});
+    part.insert({20, 0});
+    result = result && _assert(false);
+  } catch (cppgres::pg_exception &e) {
+    cppgres::ffi_guarded(::RollbackAndReleaseCurrentSubTransaction)();
+  }
+
+  // permanent tables can't be loaded in read-only transactions
+  cppgres::ffi_guarded(::BeginInternalSubTransaction)(nullptr);
+  try {
+    cppgres::ffi_guarded(::SPI_execute)("create table bulk_insert_permanent (a int8, b int4); "
+                                        "set local transaction_read_only = on",
+                                        false, 0);
+    cppgres::bulk_insert<std::tuple<int64_t, int32_t>> permanent("bulk_insert_permanent");
+    result = result && _assert(false);
+  } catch (cppgres::pg_exception &e) {
+    cppgres::ffi_guarded(::RollbackAndReleaseCurrentSubTransaction)();
+  }
   return result;
 }
 
+bool table_scan() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  cppgres::ffi_guarded(::SPI_execute)("create temporary table table_scan (a int8, b int4); "
+                                      "insert into table_scan select i, i from "
+                                      "generate_series(1, 1000) i",
+                                      false, 0);
+
+  int64_t sum = 0, count = 0;
+  for (auto &[a, b] : cppgres::table_scan<std::tuple<int64_t, std::optional<int32_t>>>(
+           "table_scan")) {
+    sum += a;
+    count++;
+  }
+  result = result && _assert(count == 1000);
+  result = result && _assert(sum == 500500);
+
+  cppgres::ffi_guarded(::SPI_execute)("create temporary table table_scan_text (a int8, b text); "
+                                      "create temporary table table_scan_dropped (a int8, c int4, "
+                                      "b int4); alter table table_scan_dropped drop column c",
+                                      false, 0);
+  try {
+    cppgres::table_scan<std::tuple<int64_t, std::optional<int32_t>>> scan("table_scan_text");
+    result = result && _assert(false);
+  } catch (std::runtime_error &e) {
+  }
+  try {
+    cppgres::table_scan<std::tuple<int64_t, int32_t, int32_t>> scan("table_scan_dropped");
+    result = result && _assert(false);
+  } catch (std::runtime_error &e) {
+  }
+
+  // dropped columns are skipped
+  cppgres::bulk_insert<std::tuple<int64_t, int32_t>> loader("table_scan_dropped");
+  loader.insert({1, 2});
+  result = result && _assert(loader.finish() == 1);
+  cppgres::table_scan<std::tuple<int64_t, int32_t>> dropped("table_scan_dropped");
+  int rows = 0;
+  for (auto &[a, b] : dropped) {
+    rows++;
+    result = result && _assert(a == 1 && b == 2);
+  }
+  result = result && _assert(rows == 1);
+  return result;
+}
+
+bool index_scan() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  cppgres::ffi_guarded(::SPI_execute)("create temporary table index_scan (a int8 primary key, "
+                                      "b int4); insert into index_scan select i, i * 2 from "
+                                      "generate_series(1, 1000) i",
+                                      false, 0);
+
+  cppgres::index_scan<std::tuple<int64_t, std::optional<int32_t>>> scan("index_scan",
+                                                                       "index_scan_pkey");
+  int count = 0;
+  for (auto &[a, b] : scan.equal(int64_t(500))) {
+    count++;
+    result = result && _assert(a == 500 && b == 1000);
+  }
+  result = result && _assert(count == 1);
+
+  count = 0;
+  for (auto &row : scan.where({{1, cppgres::index_strategy::greater_equal, int64_t(10)},
+                               {1, cppgres::index_strategy::less, int64_t(20)}})) {
+    count++;
+  }
+  result = result && _assert(count == 10);
+
+  int64_t sum = 0;
+  std::vector<int64_t> probed;
+  auto matches = scan.probe(std::vector<int64_t>{700, 3, 2000, 5},
+                            [&](const int64_t &key, auto &row) {
+                              sum += std::get<0>(row);
+                              probed.push_back(key);
+                            });
+  result = result && _assert(matches == 3);
+  result = result && _assert(sum == 708);
+  // keys are probed in index order
+  result = result && _assert((probed == std::vector<int64_t>{3, 5, 700}));
+
+  try {
+    scan.equal(true);
+    result = result && _assert(false);
+  } catch (std::runtime_error &e) {
+  }
+  try {
+    cppgres::index_scan<std::tuple<int64_t, bool>> mismatched("index_scan", "index_scan_pkey");
+    result = result && _assert(false);
+  } catch (std::runtime_error &e) {
+  }
+  return result;
+}
+
+bool direct_executor() {
+  bool result = true;
+  cppgres::direct_executor exec;
+  auto res = exec.query<std::tuple<std::optional<int64_t>>>(
+      "select $1 + i from generate_series(1,100) i", int64_t(1));
+  result = result && _assert(res.size() == 100);
+  int64_t i = 0;
+  for (auto &re : res) {
+    i++;
+    result = result && _assert(std::get<0>(re) == i + 1);
+  }
+
+  int64_t sum = 0;
+  auto n = exec.for_each<std::tuple<std::optional<int64_t>>>(
+      "select i from generate_series(1,$1) i",
+      [&](std::tuple<std::optional<int64_t>> &row) { sum += std::get<0>(row).value(); },
+      int64_t(100));
+  result = result && _assert(n == 100);
+  result = result && _assert(sum == 5050);
+
+  {
+    cppgres::spi_executor spi;
+    cppgres::ffi_guarded(::SPI_execute)("create temporary table direct_executor (a int8)", false,
+                                        0);
+  }
+  try {
+    exec.query<std::tuple<std::optional<int64_t>>>("insert into direct_executor values (1)");
+    result = result && _assert(false);
+  } catch (cppgres::pg_exception &e) {
+  }
+  cppgres::ffi_guarded(::BeginInternalSubTransaction)(nullptr);
+  try {
+    exec.query<std::tuple<std::optional<int64_t>>>(
+        "select 1 / (i - 5) from generate_series(1,10) i");
+    result = result && _assert(false);
+  } catch (cppgres::pg_exception &e) {
+    cppgres::ffi_guarded(::RollbackAndReleaseCurrentSubTransaction)();
+  }
+  res = exec.query<std::tuple<std::optional<int64_t>>>("select count(*) from direct_executor");
+  result = result && _assert(std::get<0>(*res.begin()) == 0);
+  return result;
+}
+
+bool spi_column() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  auto res = spi.query<std::tuple<std::optional<int64_t>>>(
+      "select case when i % $1 = 0 then null else i end from generate_series(1,100) i",
+      int64_t(10));
+
+  auto col = res.column<0>();
+  result = result && _assert(col.size() == 100);
+  int64_t sum = 0;
+  for (auto v : col.values()) {
+    sum += v;
+  }
+  result = result && _assert(sum == 5050 - 550);
+  result = result && _assert(col.is_null(9) && !col.is_null(10));
+  result = result && _assert(col[0] == 1);
+  return result;
+}
+
+bool spi_cursor() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  auto cursor = spi.query_cursor<std::tuple<std::optional<int64_t>>>(
+      "select i from generate_series(1,100) i", 7);
+
+  int64_t i = 0;
+  for (auto &re : cursor) {
+    i++;
+    result = result && _assert(std::get<0>(re) == i);
+  }
+  result = result && _assert(i == 100);
+
+  // a batch has at least one row
+  auto single = spi.query_cursor<std::tuple<std::optional<int64_t>>>(
+      "select i from generate_series(1,100) i", 0);
+  result = result && _assert(single.fetch().size() == 1);
+  single.close();
+
+  // closing a cursor whose subtransaction was aborted leaves its (dropped) portal alone
+  cppgres::ffi_guarded(::BeginInternalSubTransaction)(nullptr);
+  auto failing = spi.query_cursor<std::tuple<std::optional<int64_t>>>(
+      "select 1 / (i - 5) from generate_series(1,10) i", 3);
+  try {
+    for (auto &re : failing) {
+    }
+    result = result && _assert(false);
+  } catch (cppgres::pg_exception &e) {
+    cppgres::ffi_guarded(::RollbackAndReleaseCurrentSubTransaction)();
+  }
+  failing.close();
+  return result;
+}
+
+bool spi_lazy() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  auto res = spi.query<std::tuple<int64_t, std::optional<int64_t>, std::optional<bool>>>(
+      "select i as a, null::int8 as b, i % 2 = 0 as c from generate_series(1,$1) i", int64_t(10));
+  int64_t i = 0;
+  for (auto &row : res.lazy()) {
+    i++;
+    result = result && _assert(row.get<0>() == i);
+    result = result && _assert(!row.get<1>().has_value());
+    result = result && _assert(row.get<bool>("c") == (i % 2 == 0));
+    result = result && _assert(std::get<0>(row.decode()) == i);
+  }
+  result = result && _assert(i == 10);
+
+  try {
+    (*res.lazy().begin()).get<int64_t>("d");
+    result = result && _assert(false);
+  } catch (std::out_of_range &e) {
+  }
+  return result;
+}
+
+struct positional_record {
+  int64_t a;
+  std::optional<int64_t> b;
+};
+
+struct named_record {
+  std::optional<bool> even;
+  int64_t i;
+};
+
 } // namespace tests
 
-static std::optional<bool> cppgres_tests_impl() {
-  using namespace tests;
-  return nullable_datum_enforcement() && catch_error() && exception_to_error() &&
-         alloc_set_context() && allocator() && current_memory_context() &&
-         memory_context_for_ptr() && spi() && varlena_text();
+template <> struct cppgres::field_names<tests::named_record> {
+  static constexpr std::array<std::string_view, 2> names = {"even", "i"};
+};
+
+namespace tests {
+
+bool spi_records() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  static_assert(cppgres::record<positional_record>);
+  static_assert(cppgres::named_record<named_record>);
+
+  auto rows = spi.query<positional_record>(
+      "select i, case when i > 5 then i end from generate_series(1,$1) i", int64_t(10));
+  result = result && _assert(rows.size() == 10);
+  result = result && _assert(rows[0].a == 1 && !rows[0].b.has_value());
+  result = result && _assert(rows[9].a == 10 && rows[9].b == 10);
+
+  auto stmt = spi.prepare<named_record, int64_t>(
+      "select i * 2 as i, 'unused' as x, i % 2 = 0 as even from generate_series(1,$1) i");
+  for (int64_t n = 1; n < 3; n++) {
+    auto named = stmt(n * 5);
+    result = result && _assert(named.size() == n * 5);
+    result = result && _assert(named[1].i == 4 && named[1].even == true);
+  }
+
+  cppgres::ffi_guarded(::SPI_execute)("create temporary table spi_records (i int8, even bool); "
+                                      "insert into spi_records values (1, false)",
+                                      false, 0);
+  auto table = spi.prepare<named_record>("select * from spi_records");
+  result = result && _assert(table()[0].i == 1 && table()[0].even == false);
+  cppgres::ffi_guarded(::SPI_execute)("alter table spi_records drop column i; "
+                                      "alter table spi_records add column i int8; "
+                                      "update spi_records set i = 2, even = true",
+                                      false, 0);
+  result = result && _assert(table()[0].i == 2 && table()[0].even == true);
+  return result;
 }
 
-postgres_function(cppgres_tests, cppgres_tests_impl);
+bool spi_stream() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  int64_t i = 0;
+  for (auto &re : spi.stream<std::tuple<int64_t>>("select i from generate_series(1,$1) i", 16,
+                                                  int64_t(1000000)) |
+                      std::views::take(5)) {
+    i++;
+    result = result && _assert(std::get<0>(re) == i);
+  }
+  result = result && _assert(i == 5);
+
+  i = 0;
+  for (auto &re : spi.stream<std::tuple<int64_t>>("select i from generate_series(1,20) i", 3)) {
+    i += std::get<0>(re);
+  }
+  result = result && _assert(i == 210);
+  return result;
+}
 
-static const char *find_absolute_library_path(const char *filename) {
-  const char *result = filename;
-#ifdef __linux__
-  // Not a great solution, but not aware of anything else yet.
-  // This code below reads /proc/self/maps and finds the path to the
-  // library by matching the base address of omni_ext shared library.
+bool spi_prepare() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  auto stmt = spi.prepare<std::tuple<std::optional<int64_t>>, int64_t>("select $1 + 1");
+  for (int64_t i = 0; i < 10; i++) {
+    auto res = stmt(i);
+    result = result && _assert(std::get<0>(*res.begin()) == i + 1);
+  }
+  auto stmt1 = spi.prepare<std::tuple<std::optional<int64_t>>, int64_t>("select $1 + 1");
+  result = result && _assert(stmt.plan() == stmt1.plan());
+  return result;
+}
+
+static cppgres::utils::generator<std::tuple<int64_t, bool>> srf_series_impl(int64_t n) {
+  for (int64_t i = 1; i <= n; i++) {
+    co_yield std::tuple<int64_t, bool>(i, i % 2 == 0);
+  }
+}
+
+postgres_set_returning_function(srf_series, srf_series_impl);
+postgres_function_sql(srf_series, "(int8) returns table (i int8, even bool)",
+                      cppgres::sql::rows<10>, cppgres::sql::support<"srf_series_support">);
+
+static std::vector<int64_t> srf_vector_impl(int64_t n) {
+  std::vector<int64_t> values;
+  for (int64_t i = 1; i <= n; i++) {
+    values.push_back(i * 10);
+  }
+  return values;
+}
+
+postgres_materialized_function(srf_vector, srf_vector_impl);
+postgres_function_sql(srf_vector, "(int8) returns setof int8");
+
+bool set_returning_functions() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  auto series = spi.query<std::tuple<int64_t, int64_t>>(
+      "select count(*), sum(i)::int8 from srf_series($1) where even", int64_t(10));
+  result = result && _assert(std::get<0>(*series.begin()) == 5);
+  result = result && _assert(std::get<1>(*series.begin()) == 30);
+
+  auto declared = spi.query<std::tuple<bool>>(
+      "select prorows = 10 and proretset from pg_proc where proname = 'srf_series'");
+  result = result && _assert(std::get<0>(*declared.begin()));
+
+  // value-per-call producers stop as soon as the executor does
+  auto limited = spi.query<std::tuple<int64_t>>(
+      "select i from srf_series($1) limit 3", int64_t(1000000000));
+  result = result && _assert(limited.size() == 3);
+
+  auto vector = spi.query<std::tuple<int64_t, int64_t>>(
+      "select count(*), sum(v)::int8 from srf_vector($1) v", int64_t(10));
+  result = result && _assert(std::get<0>(*vector.begin()) == 10);
+  result = result && _assert(std::get<1>(*vector.begin()) == 550);
+  return result;
+}
+
+struct series_rows {
+  std::optional<double> operator()(cppgres::rows_request &request) {
+    auto n = request.constant_argument<int64_t>(0);
+    return n.has_value() ? std::optional<double>(*n) : std::nullopt;
+  }
+};
+
+postgres_support_function(srf_series_support, series_rows{});
+postgres_function_sql(srf_series_support, "(internal) returns internal");
+
+static bool is_even_impl(int64_t i) { return i % 2 == 0; }
+
+postgres_function(is_even, is_even_impl);
+postgres_function_sql(is_even, "(int8) returns bool", cppgres::sql::strict,
+                      cppgres::sql::support<"is_even_support">);
+
+struct is_even_planning {
+  std::optional<Selectivity> operator()(cppgres::selectivity_request &request) {
+    return request.is_join() ? 0.1 : 0.5;
+  }
 
-  FILE *f = fopen("/proc/self/maps", "r");
-  if (NULL == f) {
-    return result;
+  std::optional<cppgres::cost_estimate> operator()(cppgres::cost_request &) {
+    return cppgres::cost_estimate{.startup = 0, .per_tuple = 100};
   }
 
-  // Get the base address of omni_ext shared library
-  Dl_info info;
-  dladdr(get_library_name, &info);
+  ::Node *operator()(cppgres::simplify_request &request) {
+    auto i = request.constant_argument<int64_t>(0);
+    return i.has_value() ? request.constant(is_even_impl(*i)) : nullptr;
+  }
+};
 
-  // We can keep this name around forever as it'll be used to create handles
-  char *path = MemoryContextAllocZero(TopMemoryContext, NAME_MAX + 1);
-  char *format = psprintf("%%lx-%%*x %%*s %%*s %%*s %%*s %%%d[^\n]", NAME_MAX);
+postgres_support_function(is_even_support, is_even_planning{});
+postgres_function_sql(is_even_support, "(internal) returns internal");
 
-  uintptr_t base;
-  while (fscanf(f, (const char *)format, &base, path) >= 1) {
-    if (base == (uintptr_t)info.dli_fbase) {
-      result = path;
-      goto done;
+static bool explains_to(std::string_view query, std::string_view expected) {
+  cppgres::spi_executor spi;
+  auto plan = spi.query<std::tuple<std::optional<cppgres::text>>>(std::string(query));
+  for (auto [line] : plan) {
+    std::string_view text = *line;
+    if (text.find(expected) != std::string_view::npos) {
+      return true;
     }
   }
-done:
-  pfree(format);
-  fclose(f);
-#endif
+  return false;
+}
+
+bool support_functions() {
+  bool result = true;
+  result = result && _assert(explains_to("explain select * from srf_series(42)", "rows=42 "));
+  result = result && _assert(explains_to("explain select * from generate_series(1, 1000) i "
+                                         "where is_even(i)",
+                                         "rows=500 "));
+  result = result && _assert(explains_to("explain (verbose, costs off) select is_even(4)",
+                                         "Output: true"));
+
+  // 10 calls at the estimated cost of 100 each dominate the cost of the scan
+  result = result && _assert(explains_to("explain select is_even(i) from generate_series(1, 10) i",
+                                         "..1000."));
+  result = result && _assert(explains_to("explain select * from generate_series(1, 1000) a, "
+                                         "generate_series(1, 1000) b where is_even(a + b)",
+                                         "rows=100000 "));
+
+  // without a constant argument the request is declined, and the declared ROWS is used
+  result = result && _assert(explains_to("explain select * from srf_series((random() * 5)::int8)",
+                                         "rows=10 "));
+  return result;
+}
+
+static int64_t add_one_impl(int64_t i) { return i + 1; }
+
+postgres_function(add_one, add_one_impl);
+postgres_function_sql(add_one, "(int8) returns int8");
+
+bool function_call_site() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  // the call site is shared by all rows, the arguments are checked once
+  auto res = spi.query<std::tuple<int64_t>>(
+      "select sum(add_one(i))::int8 from generate_series(1,$1) i", int64_t(100));
+  result = result && _assert(std::get<0>(*res.begin()) == 5150);
   return result;
 }
 
-static const char *get_library_name() {
-  const char *library_name = NULL;
-  // If we have already determined the name, return it
-  if (library_name) {
-    return library_name;
+static int64_t add_strict_impl(int64_t a, int64_t b) noexcept { return a + b; }
+
+postgres_strict_function(add_strict, add_strict_impl);
+postgres_function_sql(add_strict, "(int8, int8) returns int8", cppgres::sql::immutable,
+                      cppgres::sql::strict, cppgres::sql::parallel_safe, cppgres::sql::leakproof,
+                      cppgres::sql::cost<1>);
+
+bool strict_function() {
+  bool result = true;
+  static_assert(cppgres::postgres_strict_function<decltype(&add_strict_impl)>::nothrow);
+  cppgres::spi_executor spi;
+  auto declared = spi.query<std::tuple<bool, bool, bool, bool, bool>>(
+      "select provolatile = 'i', proisstrict, proparallel = 's', proleakproof, procost = 1 "
+      "from pg_proc where proname = 'add_strict'");
+  auto [immutable, strict, parallel_safe, leakproof, cost] = *declared.begin();
+  result = result && _assert(immutable && strict && parallel_safe && leakproof && cost);
+
+  auto res = spi.query<std::tuple<int64_t, int64_t>>(
+      "select sum(add_strict(i, $1))::int8, coalesce(add_strict(1, null), -1) "
+      "from generate_series(1,100) i",
+      int64_t(2));
+  result = result && _assert(std::get<0>(*res.begin()) == 5250);
+  result = result && _assert(std::get<1>(*res.begin()) == -1);
+
+  // a declaration that doesn't match the implementation is an error, not a crash
+  auto probin = spi.query<std::tuple<std::string>>(
+      "select probin from pg_proc where proname = 'add_strict'");
+  auto library = std::get<0>(*probin.begin());
+  cppgres::ffi_guarded(::BeginInternalSubTransaction)(nullptr);
+  try {
+    auto ddl = std::format("create function add_strict_mismatch(int8) returns int8 "
+                           "language c strict as '{}', 'add_strict'", library);
+    cppgres::ffi_guarded(::SPI_execute)(ddl.c_str(), false, 0);
+    spi.query<std::tuple<int64_t>>("select add_strict_mismatch(1)");
+    result = result && _assert(false);
+  } catch (cppgres::pg_exception &e) {
+    cppgres::ffi_guarded(::RollbackAndReleaseCurrentSubTransaction)();
   }
-  Dl_info info;
-  ::dladdr((void *)cppgres_tests, &info);
-  library_name = info.dli_fname;
-  if (index(library_name, '/') == NULL) {
-    // Not a full path, try to determine it. On some systems it will be a full path, on some it
-    // won't.
-    library_name = find_absolute_library_path(library_name);
+  return result;
+}
+
+struct int_mean {
+  int64_t count = 0;
+  int64_t sum = 0;
+
+  void update(int64_t value) {
+    count++;
+    sum += value;
+  }
+
+  std::optional<int64_t> finalize() const {
+    return count == 0 ? std::nullopt : std::optional(sum / count);
   }
-  return library_name;
+
+  void combine(const int_mean &other) {
+    count += other.count;
+    sum += other.sum;
+  }
+
+  std::array<std::byte, 2 * sizeof(int64_t)> serialize() const {
+    std::array<std::byte, 2 * sizeof(int64_t)> bytes;
+    std::memcpy(bytes.data(), &count, sizeof(int64_t));
+    std::memcpy(bytes.data() + sizeof(int64_t), &sum, sizeof(int64_t));
+    return bytes;
+  }
+
+  static int_mean deserialize(std::span<const std::byte> bytes) {
+    int_mean state;
+    std::memcpy(&state.count, bytes.data(), sizeof(int64_t));
+    std::memcpy(&state.sum, bytes.data() + sizeof(int64_t), sizeof(int64_t));
+    return state;
+  }
+};
+
+postgres_parallel_aggregate(int_mean, tests::int_mean);
+postgres_function_sql(int_mean_transfn, "(internal, int8) returns internal");
+postgres_function_sql(int_mean_finalfn, "(internal) returns int8");
+postgres_function_sql(int_mean_combinefn, "(internal, internal) returns internal");
+postgres_function_sql(int_mean_serialfn, "(internal) returns bytea", cppgres::sql::strict);
+postgres_function_sql(int_mean_deserialfn, "(bytea, internal) returns internal",
+                      cppgres::sql::strict);
+postgres_parallel_aggregate_sql(int_mean, "(int8)");
+
+bool aggregate() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  auto res = spi.query<std::tuple<int64_t, int64_t, int64_t>>(
+      "select int_mean(i), int_mean(case when i % 2 = 0 then i end), "
+      "coalesce(int_mean(case when i < 0 then i end), -1) from generate_series(1,$1) i",
+      int64_t(100));
+  result = result && _assert(std::get<0>(*res.begin()) == 50);
+  result = result && _assert(std::get<1>(*res.begin()) == 51);
+  result = result && _assert(std::get<2>(*res.begin()) == -1);
+
+  auto groups = spi.query<std::tuple<int64_t, int64_t>>(
+      "select i % 2, int_mean(i) from generate_series(1,$1) i group by 1 order by 1",
+      int64_t(100));
+  auto ra = groups.random_access();
+  result = result && _assert(std::get<1>(ra[0]) == 51);
+  result = result && _assert(std::get<1>(ra[1]) == 50);
+
+  // partial states are serialized by the workers and combined by the leader
+  cppgres::ffi_guarded(::BeginInternalSubTransaction)(nullptr);
+  cppgres::ffi_guarded(::SPI_execute)(
+      "create table int_mean_parallel as select i::int8 from generate_series(1, 10000) i; "
+      "set local parallel_setup_cost = 0; set local parallel_tuple_cost = 0; "
+      "set local min_parallel_table_scan_size = 0; set local debug_parallel_query = on",
+      false, 0);
+  result = result && _assert(explains_to(
+                         "explain (costs off) select int_mean(i) from int_mean_parallel",
+                         "Partial Aggregate"));
+  {
+    auto parallel = spi.query<std::tuple<int64_t>>("select int_mean(i) from int_mean_parallel");
+    result = result && _assert(std::get<0>(*parallel.begin()) == 5000);
+  }
+  cppgres::ffi_guarded(::RollbackAndReleaseCurrentSubTransaction)();
+  return result;
+}
+
+static std::tuple<int64_t, int64_t> divmod_impl(int64_t a, int64_t b) {
+  return {a / b, a % b};
 }
 
-extern "C" void _PG_init(void) {
-  static bool initialized = false;
-  if (!initialized) {
-    initialized = true;
-    cppgres::ffi_guarded(::SPI_connect)();
-    auto stmt =
-        std::format("create or replace function cppgres_tests() returns bool language 'c' as '{}'",
-                    get_library_name());
-    cppgres::ffi_guarded(::SPI_execute)(stmt.c_str(), false, 0);
-    cppgres::ffi_guarded(::SPI_finish)();
+postgres_function(divmod, divmod_impl);
+postgres_function_sql(divmod, "(a int8, b int8, out q int8, out r int8)");
+
+struct min_max_result {
+  int64_t max;
+  std::optional<int64_t> min;
+};
+
+} // namespace tests
+
+template <> struct cppgres::field_names<tests::min_max_result> {
+  static constexpr std::array<std::string_view, 2> names = {"max", "min"};
+};
+
+namespace tests {
+
+static min_max_result min_max_impl(int64_t a, std::optional<int64_t> b) {
+  if (!b.has_value()) {
+    return {a, std::nullopt};
   }
+  return {std::max(a, *b), std::min(a, *b)};
+}
+
+postgres_function(min_max, min_max_impl);
+postgres_function_sql(min_max, "(a int8, b int8, out min int8, out max int8)");
+
+bool composite_results() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  auto res = spi.query<std::tuple<int64_t, int64_t>>(
+      "select sum((divmod(i, 7)).q)::int8, sum((divmod(i, 7)).r)::int8 "
+      "from generate_series(1,$1) i",
+      int64_t(20));
+  result = result && _assert(std::get<0>(*res.begin()) == 21);
+  result = result && _assert(std::get<1>(*res.begin()) == 63);
+
+  auto mm = spi.query<std::tuple<std::optional<int64_t>, int64_t>>(
+      "select (min_max(3, 2)).min, (min_max(3, 2)).max "
+      "union all select (min_max(1, null)).min, (min_max(1, null)).max");
+  auto ra = mm.random_access();
+  result = result && _assert(std::get<0>(ra[0]) == 2);
+  result = result && _assert(std::get<1>(ra[0]) == 3);
+  result = result && _assert(!std::get<0>(ra[1]).has_value());
+  result = result && _assert(std::get<1>(ra[1]) == 1);
+  return result;
 }
+
+static int64_t pair_sum_impl(std::tuple<int64_t, std::optional<int64_t>> pair) {
+  return std::get<0>(pair) + std::get<1>(pair).value_or(0);
+}
+
+postgres_function(pair_sum, pair_sum_impl);
+postgres_function_sql(pair_sum, "(record) returns int8");
+
+struct labeled_pair {
+  std::optional<int64_t> b;
+  int64_t a;
+};
+
+} // namespace tests
+
+template <> struct cppgres::field_names<tests::labeled_pair> {
+  static constexpr std::array<std::string_view, 2> names = {"b", "a"};
+};
+
+namespace tests {
+
+static int64_t pair_diff_impl(std::optional<labeled_pair> pair) {
+  if (!pair.has_value()) {
+    return -1;
+  }
+  return pair->a - pair->b.value_or(0);
+}
+
+postgres_composite_type_sql(cppgres_pair, "(a int8, b int8)");
+postgres_function(pair_diff, pair_diff_impl);
+postgres_function_sql(pair_diff, "(cppgres_pair) returns int8");
+
+bool composite_arguments() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  auto res = spi.query<std::tuple<int64_t, int64_t, int64_t>>(
+      "select sum(pair_sum(row(i::int8, i::int8 * 2)))::int8, "
+      "sum(pair_sum(row(i::int8, null::int8)))::int8, "
+      "sum(pair_diff(row(i * 3, i)::cppgres_pair))::int8 from generate_series(1,$1) i",
+      int64_t(10));
+  result = result && _assert(std::get<0>(*res.begin()) == 165);
+  result = result && _assert(std::get<1>(*res.begin()) == 55);
+  result = result && _assert(std::get<2>(*res.begin()) == 110);
+
+  auto nulls = spi.query<std::tuple<int64_t>>("select pair_diff(null)");
+  result = result && _assert(std::get<0>(*nulls.begin()) == -1);
+  return result;
+}
+
+static int64_t window_row_number_impl(cppgres::window_object &window) {
+  return ++window.partition_state<int64_t>();
+}
+
+postgres_window_function(window_row_number, window_row_number_impl);
+postgres_function_sql(window_row_number, "() returns int8", cppgres::sql::window);
+
+static std::optional<int64_t> window_frame_sum_impl(cppgres::window_object &window,
+                                                    std::optional<int64_t> value) {
+  if (!value.has_value()) {
+    return std::nullopt;
+  }
+  int64_t sum = 0;
+  for (int i = 0;; i++) {
+    bool isout;
+    auto v = window.argument_in_frame<int64_t>(0, i, cppgres::window_seek::head, false, &isout);
+    if (isout) {
+      break;
+    }
+    sum += v.value_or(0);
+  }
+  return sum;
+}
+
+postgres_window_function(window_frame_sum, window_frame_sum_impl);
+postgres_function_sql(window_frame_sum, "(int8) returns int8", cppgres::sql::window);
+
+bool window_functions() {
+  bool result = true;
+  cppgres::spi_executor spi;
+  auto res = spi.query<std::tuple<int64_t, int64_t, int64_t>>(
+      "select i, window_row_number() over (partition by i % 2 order by i), "
+      "window_frame_sum(i) over (order by i rows between 1 preceding and current row) "
+      "from generate_series(1,$1) i order by i",
+      int64_t(6));
+  auto ra = res.random_access();
+  result = result && _assert(std::get<1>(ra[0]) == 1);
+  result = result && _assert(std::get<1>(ra[1]) == 1);
+  result = result && _assert(std::get<1>(ra[4]) == 3);
+  result = result && _assert(std::get<1>(ra[5]) == 3);
+  result = result && _assert(std::get<2>(ra[0]) == 1);
+  result = result && _assert(std::get<2>(ra[3]) == 7);
+  result = result && _assert(std::get<2>(ra[5]) == 11);
+  return result;
+}
+
+static bool varlena_text() {
+  bool result = true;
+  auto nd = cppgres::nullable_datum(::PointerGetDatum(::cstring_to_text("test")));
+  auto s = cppgres::from_nullable_datum<cppgres::text>(nd);
+  std::string_view str = *s;
+  result = result && _assert(str == "test");
+  return result;
+}
+
+} // namespace tests
+
+static std::optional<bool> cppgres_tests_impl() {
+  using namespace tests;
+  return nullable_datum_enforcement() && catch_error() && exception_to_error() &&
+         alloc_set_context() && allocator() && current_memory_context() &&
+         memory_context_for_ptr() && spi() && spi_arguments() && spi_options() &&
+         spi_for_each() && spi_execute_many() && bulk_insert() && table_scan() && index_scan() &&
+         direct_executor() && spi_column() && spi_cursor() && spi_lazy() && spi_records() &&
+         spi_stream() && spi_prepare() && set_returning_functions() && support_functions() &&
+         function_call_site() && strict_function() && aggregate() && composite_results() &&
+         composite_arguments() && window_functions() && varlena_text();
+}
+
+postgres_function(cppgres_tests, cppgres_tests_impl);
+postgres_function_sql(cppgres_tests, "() returns bool");